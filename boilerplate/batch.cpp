@@ -0,0 +1,153 @@
+#include "batch.h"
+#include "gaussian.h"
+#include "threadpool.h"
+#include <stb/stb_image_write.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <dirent.h>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+// spec names of the GaussianMethod values, in order
+static const char* const METHOD_NAMES[4] = { "direct", "recursive", "box", "fft" };
+
+MyBatchSpec::MyBatchSpec() : mode(0), filt(0), gSize(3), method(GAUSSIAN_DIRECT)
+	{}
+
+bool ParseBatchSpec(MyBatchSpec* spec, const string& text)
+{
+	vector<string> fields;
+	stringstream in(text);
+	string field;
+	while (getline(in, field, ':'))
+		fields.push_back(field);
+	if (fields.size() < 2 || fields.size() > 4)
+		return false;
+
+	int values[3] = { 0, 0, spec->gSize };
+	for (size_t i=0; i<fields.size() && i<3; i++) {
+		stringstream number(fields[i]);
+		if (!(number >> values[i]) || !number.eof())
+			return false;
+	}
+	if (values[0] < 0 || values[0] > 4 || values[2] < 1)
+		return false;
+	spec->mode = values[0];
+	spec->filt = values[1];
+	spec->gSize = values[2];
+
+	if (fields.size() == 4) {
+		const GaussianMethod methods[4] = { GAUSSIAN_DIRECT, GAUSSIAN_RECURSIVE, GAUSSIAN_BOX, GAUSSIAN_FFT };
+		int found = -1;
+		for (int i=0; i<4; i++)
+			if (fields[3] == METHOD_NAMES[i])
+				found = i;
+		if (found < 0)
+			return false;
+		spec->method = methods[found];
+	}
+	return true;
+}
+
+// file names in dir that stb_image can decode, sorted
+static vector<string> ListImages(const char* dir)
+{
+	vector<string> names;
+	DIR *listing = opendir(dir);
+	if (!listing)
+		return names;
+	const char *extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tga" };
+	for (dirent *entry = readdir(listing); entry; entry = readdir(listing)) {
+		string name = entry->d_name;
+		string lower = name;
+		transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+		for (size_t i=0; i<sizeof(extensions)/sizeof(extensions[0]); i++) {
+			size_t length = string(extensions[i]).size();
+			if (lower.size() > length && lower.compare(lower.size() - length, length, extensions[i]) == 0) {
+				names.push_back(name);
+				break;
+			}
+		}
+	}
+	closedir(listing);
+	sort(names.begin(), names.end());
+	return names;
+}
+
+// name with its extension swapped for .png
+static string OutputName(const string& name)
+{
+	return name.substr(0, name.rfind('.')) + ".png";
+}
+
+bool WriteImagePNG(const MyImage* image, const string& filename)
+{
+	int stride = 4*image->width;
+	vector<unsigned char> bytes(stride*image->height), flipped(bytes.size());
+	ImageBytes(image, &bytes[0]);
+	for (int y=0; y<image->height; y++)
+		copy(bytes.begin() + (size_t)y*stride, bytes.begin() + (size_t)(y+1)*stride,
+			flipped.begin() + (size_t)(image->height - 1 - y)*stride);
+	return stbi_write_png(filename.c_str(), image->width, image->height, 4, &flipped[0], stride) != 0;
+}
+
+int RunBatch(const char* inDir, const MyBatchSpec& spec, const char* outDir)
+{
+	vector<string> names = ListImages(inDir);
+	if (names.empty()) {
+		cout << "No images found in " << inDir << endl;
+		return 1;
+	}
+	MyImage border;
+	if (spec.mode == 0 && spec.filt == 5 && !InitializeImage(&border, "blood2.png"))
+		return (int)names.size();
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	atomic<int> failures(0);
+	atomic<long long> bytes(0);
+	mutex output;
+	// one image per thread; the filters' own ParallelFor calls run serially
+	// inside the pool, so the images themselves are the unit of work
+	DefaultThreadPool().ParallelFor((int)names.size(), [&](int begin, int end) {
+		for (int i=begin; i<end; i++) {
+			string in = string(inDir) + "/" + names[i];
+			string out = string(outDir) + "/" + OutputName(names[i]);
+			MyImage image, filtered;
+			bool success = InitializeImage(&image, in.c_str()) &&
+				FilterImage(&filtered, &image, spec.mode, spec.filt, spec.gSize, &border, spec.method) &&
+				WriteImagePNG(&filtered, out);
+			bytes += 4LL*image.width*image.height;
+			lock_guard<mutex> lock(output);
+			if (success)
+				cout << in << " -> " << out << endl;
+			else {
+				cout << "Failed to filter " << in << endl;
+				failures++;
+			}
+		}
+	});
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	int done = (int)names.size() - failures;
+	cout << done << " images, " << bytes/1048576.0 << " MB of RGBA8 pixels in " << seconds << " s: "
+		<< done/seconds << " images/sec, " << bytes/1048576.0/seconds << " MB/sec ("
+		<< DefaultThreadPool().Size() << " threads)" << endl;
+
+	// an approximate Gaussian reports how far it is from the direct kernel,
+	// measured on the first image (outside the timing above)
+	MyImage first;
+	if ((spec.mode == 2 || spec.mode == 3) && spec.filt != 0 && spec.method != GAUSSIAN_DIRECT &&
+		InitializeImage(&first, (string(inDir) + "/" + names[0]).c_str())) {
+		GaussianAccuracy accuracy = MeasureGaussianAccuracy(&first, FilterSigma(spec.filt),
+			(spec.gSize-1)/2, spec.method);
+		cout << METHOD_NAMES[spec.method] << " vs direct kernel on " << names[0] << ": max error "
+			<< accuracy.maxError << ", RMS " << accuracy.rmsError << " levels, PSNR " << accuracy.psnr
+			<< " dB (direct kernel covers " << 100*accuracy.coverage << "% of the Gaussian)" << endl;
+	}
+	return failures;
+}
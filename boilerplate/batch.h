@@ -0,0 +1,35 @@
+#pragma once
+#include "filter.h"
+#include <string>
+
+// --------------------------------------------------------------------------
+// Headless batch filtering with the CPU engine, for
+//
+//     boilerplate.out --batch <in dir> <mode:filt[:gSize[:method]]> <out dir>
+//
+// every image in the input directory is filtered and written to the output
+// directory as a PNG of the same name; images are spread over the thread
+// pool, one per thread
+
+struct MyBatchSpec
+{
+	int mode;
+	int filt;
+	int gSize;
+	GaussianMethod method;
+
+	// initialize to the interactive defaults (mode 0, filt 0, gSize 3)
+	MyBatchSpec();
+};
+
+// parses "mode:filt[:gSize[:method]]", method one of direct, recursive,
+// box or fft; returns false on anything else
+bool ParseBatchSpec(MyBatchSpec* spec, const std::string& text);
+
+// writes image as an RGBA PNG, top row first
+bool WriteImagePNG(const MyImage* image, const std::string& filename);
+
+// filters inDir into outDir and prints throughput, and for a recursive, box
+// or FFT Gaussian its accuracy against the direct kernel on the first
+// image; returns the number of images that failed
+int RunBatch(const char* inDir, const MyBatchSpec& spec, const char* outDir);
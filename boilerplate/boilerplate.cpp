@@ -18,16 +18,27 @@
 #include <algorithm>
 #include <string>
 #include <iterator>
+#include <map>
+#include <sstream>
+#include <tuple>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <math.h>
+#include <stdlib.h>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
 #include "texture.h"
-//#include "fbo.h"
+#include "compute.h"
+#include "gaussian.h"
+#include "fbo.h"
+#include "glstate.h"
+#include "resultcache.h"
+#include "export.h"
+#include "batch.h"
+#include "sequence.h"
 
 using namespace std;
 using namespace glm;
@@ -44,26 +55,53 @@ GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader);
 // --------------------------------------------------------------------------
 // Functions to set up OpenGL shader programs for rendering
 
-// load, compile, and link shaders, returning true if successful
+// fragment source and compiled vertex shader, kept to build specialized
+// programs from as they are needed
+string fragmentSource;
+GLuint vertexShader = 0;
+
+// compiles fragment.glsl with defines inserted after its #version line
+// and links it with the vertex shader; returns 0 on failure
+GLuint BuildProgram(const string &defines)
+{
+	string source = fragmentSource;
+	size_t line = source.find('\n', source.find("#version")) + 1;
+	source.insert(line, defines);
+
+	GLuint fragment = CompileShader(GL_FRAGMENT_SHADER, source);
+	GLint status;
+	glGetShaderiv(fragment, GL_COMPILE_STATUS, &status);
+	GLuint program = 0;
+	if (status == GL_TRUE) {
+		program = LinkProgram(vertexShader, fragment);
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status == GL_FALSE) {
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+	glDeleteShader(fragment);
+
+	if (program) {
+		CacheUniformLocations(program);
+		CachedUseProgram(program);
+		CachedUniform1i(program, "ourTexture", 0);
+		CachedUniform1i(program, "borderTexture", 1);
+	}
+	return program;
+}
+
+// load, compile, and link shaders, returning the generic program (mode and
+// filter as uniforms), or 0 on failure
 GLuint InitializeShaders()
 {
 	// load shader source from files
 	string vertexSource = LoadSource("shaders/vertex.glsl");
-	string fragmentSource = LoadSource("shaders/fragment.glsl");
+	fragmentSource = LoadSource("shaders/fragment.glsl");
 	if (vertexSource.empty() || fragmentSource.empty()) return false;
 
-	// compile shader source into shader objects
-	GLuint vertex = CompileShader(GL_VERTEX_SHADER, vertexSource);
-	GLuint fragment = CompileShader(GL_FRAGMENT_SHADER, fragmentSource);
-
-	// link shader program
-	GLuint program = LinkProgram(vertex, fragment);
-
-	glDeleteShader(vertex);
-	glDeleteShader(fragment);
-
-	// check for OpenGL errors and return false if error occurred
-	return program;
+	vertexShader = CompileShader(GL_VERTEX_SHADER, vertexSource);
+	return BuildProgram("");
 }
 
 // --------------------------------------------------------------------------
@@ -186,6 +224,7 @@ bool LoadGeometry(Geometry *geometry, vec2 *vertices, vec3 *colours, vec2 *textu
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vec2)*geometry->elementCount, textures, GL_STATIC_DRAW);
 	//Unbind buffer to reset to default state
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	CountGLCalls(7);
 
 	// check for OpenGL errors and return false if error occurred
 	return !CheckGLErrors();
@@ -210,9 +249,12 @@ GLuint program;
 float corners[8] = {0,0,0,0,0,0,0,0};
 char* pics[6] = { "shimakaze.png", "image1-mandrill.png", "image2-uclogo.png",
 					"image3-aerial.jpg", "image4-thirsk.jpg", "image5-pattern.png"};
-MyTexture texs[6];//, oldText[6];
-MyTexture oldText;
+MyLazyTexture texs[6];//, oldText[6];
 MyTexture border;
+// shown, unfiltered, while the current picture is still decoding
+MyTexture placeholder;
+// pixel buffers decoded pictures are copied into, for asynchronous uploads
+MyUploadBuffers uploads;
 int pic = 0;
 int mode = 0;
 int filt = 0;
@@ -225,119 +267,356 @@ double dx = 0, dy = 0, th = 0;
 double xclick = 0, yclick = 0;
 float scalar = 1.0;
 bool rel = false;
+// merge mode 3's taps in pairs into bilinear fetches (toggled with L)
+bool linearSampling = true;
 
-void RenderTexture(Geometry *fbogeo, MyTexture *tex)
+// filt/gSize/linearSampling of the kernel in a program's weight uniforms
+struct KernelState
 {
-	// clear screen to a dark grey colour
-//	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-//	glClear(GL_COLOR_BUFFER_BIT);
-
-	// bind our shader program and the vertex array object containing our
-	// scene geometry, then tell OpenGL to draw our geometry
-//	glBindTexture(GL_TEXTURE_2D, tex->textureID);
-//	glBindFramebuffer(GL_FRAMEBUFFER, oldText[pic].textureID);
-	glUseProgram(program);
-	glBindFramebuffer(GL_FRAMEBUFFER, oldText.fboID);
-	
-	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
-	glBindTexture(GL_TEXTURE_2D, tex->textureID);
-	
-//cout<<oldText.fboID<<" "<<oldText.textureID<<endl;
-//cout<<tex->textureID<<endl;
-	
-	glUniform1i(glGetUniformLocation(program,"mode"), mode);
-	glUniform1i(glGetUniformLocation(program,"filt"), filt);
-//	glUniform1i(glGetUniformLocation(program,"w"), oldText[pic].width);
-//	glUniform1i(glGetUniformLocation(program,"w"), oldText.width);
-	glUniform1i(glGetUniformLocation(program,"w"), oldText.width);
-//	glUniform1i(glGetUniformLocation(program,"h"), oldText[pic].height);
-	glUniform1i(glGetUniformLocation(program,"h"), oldText.height);
-	glUniform1i(glGetUniformLocation(program,"gSize"), gaus);
-	glUniform1i(glGetUniformLocation(program,"level"), level);
-	glUniform1i(glGetUniformLocation(program,"hori"), 1);
-	
-	glBindVertexArray(fbogeo->vertexArray);
+	int filt;
+	int gSize;
+	bool linear;
+};
+map<GLuint, KernelState> uploadedKernels;
 
-//	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, oldText.textureID, 0);	
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	
-//	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+// computes the normalized Gaussian taps for filt/gSize, and their
+// bilinear pairs, and uploads them only when those have changed; program
+// must be in use
+void UpdateGaussianWeights(GLuint program, int filt, int gSize)
+{
+	map<GLuint, KernelState>::iterator uploaded = uploadedKernels.find(program);
+	if (uploaded != uploadedKernels.end() && uploaded->second.filt == filt &&
+		uploaded->second.gSize == gSize && uploaded->second.linear == linearSampling)
+		return;
+	int bound = std::max(0, std::min((gSize-1)/2, GAUSSIAN_MAX_RADIUS));
+	vector<float> kernel = GaussianKernel(FilterSigma(filt), bound);
+	CachedUniform1fv(program, "weights", bound+1, &kernel[bound]);
+
+	vector<float> offsets, weights;
+	LinearSamplingKernel(kernel, bound, &offsets, &weights);
+	CachedUniform1fv(program, "linearOffsets", offsets.size(), &offsets[0]);
+	CachedUniform1fv(program, "linearWeights", weights.size(), &weights[0]);
+	CachedUniform1i(program, "linearTaps", linearSampling ? weights.size() : 0);
+
+	KernelState state = { filt, gSize, linearSampling };
+	uploadedKernels[program] = state;
+}
 
-// Set "renderedTexture" as our colour attachement #0
-/*	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, oldText.textureID, 0);
+// specialized programs keyed by their MODE, FILT, GSIZE and LINEAR_TAPS
+// defines, built the first time each is drawn
+typedef tuple<int, int, int, int> ShaderKey;
+map<ShaderKey, GLuint> shaderVariants;
 
-// Set the list of draw buffers.
-	GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
-	glDrawBuffers(1, DrawBuffers); // "1" is the size o
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-	cout<<"fsadf"<<endl;*/
+// the defines a draw of mode/filt/gSize depends on; every draw that shows
+// the texture unfiltered shares one passthrough variant
+ShaderKey VariantKey(int mode, int filt, int gSize)
+{
+	if (mode < 0 || mode > 5 || (filt == 0 && mode != 4 && mode != 5))
+		return ShaderKey(-1, 0, 0, 0);
+	if (mode == 5)
+		return ShaderKey(5, 0, 0, 0);
+	if (mode != 2 && mode != 3)
+		return ShaderKey(mode, filt, 0, 0);
+	int bound = std::max(0, std::min((gSize-1)/2, GAUSSIAN_MAX_RADIUS));
+	// centre tap plus one per merged pair, as LinearSamplingKernel makes
+	int taps = (mode == 3 && linearSampling) ? 1 + (bound+1)/2 : 0;
+	return ShaderKey(mode, filt, 2*bound+1, taps);
+}
 
-	// reset state to default (no shader or geometry bound)
-	glBindVertexArray(0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glUseProgram(0);
-	
-	// check for an report any OpenGL errors
-	CheckGLErrors();
+// puts the specialized program for mode/filt/gSize in use, building it the
+// first time, with its Gaussian weights up to date; falls back to the
+// generic program if the variant won't build
+GLuint UseProgram(int mode, int filt, int gSize)
+{
+	ShaderKey key = VariantKey(mode, filt, gSize);
+	map<ShaderKey, GLuint>::iterator found = shaderVariants.find(key);
+	GLuint variant;
+	if (found != shaderVariants.end())
+		variant = found->second;
+	else {
+		ostringstream defines;
+		defines << "#define MODE " << get<0>(key) << "\n"
+			<< "#define FILT " << get<1>(key) << "\n"
+			<< "#define GSIZE " << get<2>(key) << "\n"
+			<< "#define LINEAR_TAPS " << get<3>(key) << "\n";
+		variant = BuildProgram(defines.str());
+		if (!variant) {
+			cout << "Failed to specialize shader for mode " << mode << " filter " << filt
+				<< ", using the generic program" << endl;
+			variant = program;
+		}
+		shaderVariants[key] = variant;
+	}
+	CachedUseProgram(variant);
+	if (mode == 2 || mode == 3)
+		UpdateGaussianWeights(variant, filt, gSize);
+	return variant;
+}
+
+// deallocate the generic and specialized programs
+void DestroyShaders()
+{
+	CachedUseProgram(0);
+	for (map<ShaderKey, GLuint>::iterator i = shaderVariants.begin(); i != shaderVariants.end(); ++i) {
+		if (i->second != program) {
+			ForgetProgram(i->second);
+			glDeleteProgram(i->second);
+		}
+	}
+	shaderVariants.clear();
+	uploadedKernels.clear();
+	ForgetProgram(program);
+	glDeleteProgram(program);
+	glDeleteShader(vertexShader);
+	program = vertexShader = 0;
 }
 
+// offscreen passes at the source's resolution; the last one's target
+// holds the filtered image the view resamples
+MyFBOChain chain;
 
-void RenderScene(Geometry *geometry,Geometry *fbogeo, MyTexture *tex, GLuint program)
+// each pass of the chain gets its own variant and kernel
+GLuint ChainProgram(const MyPass &pass)
 {
-	// clear screen to a dark grey colour
-//	if (mode !=2 && filt !=5) {
-	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
+	// texture creation may have bound other textures since the last pass,
+	// so the border (mode 0, filt 5) is bound here rather than once
+	CachedBindTexture(1, border.textureID);
+	return UseProgram(pass.mode, pass.filt, pass.gSize);
+}
 
-	// bind our shader program and the vertex array object containing our
-	// scene geometry, then tell OpenGL to draw our geometry
-	if (mode == 3) {
-		RenderTexture(fbogeo, tex);
-//		glBindTexture(GL_TEXTURE_2D, oldText[pic].textureID);
-		glBindTexture(GL_TEXTURE_2D, oldText.textureID);
-		
-		glUseProgram(program);
-		glUniform1i(glGetUniformLocation(program,"mode"), mode);
-		glUniform1i(glGetUniformLocation(program,"filt"), filt);
-		glUniform1i(glGetUniformLocation(program,"w"), tex->width);
-		glUniform1i(glGetUniformLocation(program,"h"), tex->height);
-		glUniform1i(glGetUniformLocation(program,"gSize"), gaus);
-		glUniform1i(glGetUniformLocation(program,"level"), level);
-		glUniform1i(glGetUniformLocation(program,"hori"), 0);
-		glBindVertexArray(geometry->vertexArray);
-		glDrawArrays(GL_TRIANGLES, 0, geometry->elementCount);
+// the view's pan, zoom and rotation as one column-major mat3 for
+// vertex.glsl: the unit quad goes to the corners rectangle, scaled by
+// scalar and offset by the drag in progress (dx, dy), then rotated by th
+void ViewTransform(float* matrix)
+{
+	float cx = (corners[0] + corners[2])/2, cy = (corners[1] + corners[3])/2;
+	float hx = (corners[2] - corners[0])/2, hy = (corners[3] - corners[1])/2;
+	float tx = cx*scalar + dx, ty = cy*scalar + dy;
+	float c = cos(th), s = sin(th);
+	float transform[9] = {
+		c*hx*scalar, s*hx*scalar, 0,
+		-s*hy*scalar, c*hy*scalar, 0,
+		c*tx - s*ty, s*tx + c*ty, 1
+	};
+	std::copy(transform, transform + 9, matrix);
+}
+
+// sets program's transform for drawing the image onto the screen
+void SetViewTransform(GLuint program)
+{
+	float matrix[9];
+	ViewTransform(matrix);
+	CachedUniformMatrix3fv(program, "transform", matrix);
+}
+
+// for offscreen passes, which cover their whole target
+const float identityTransform[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+
+// render targets for mode 5's pyramid blur, level i at 1/2^(i+1) of the
+// source size; filt picks how many levels deep the blur goes
+const int PYRAMID_LEVELS = 6;
+MyTexture pyramid[PYRAMID_LEVELS];
+
+// (re)allocates the pyramid levels when the source size has changed
+bool InitializePyramid(MyTexture *tex)
+{
+	bool success = true;
+	for (int i=0; i<PYRAMID_LEVELS; i++) {
+		int w = std::max(1, tex->width >> (i+1));
+		int h = std::max(1, tex->height >> (i+1));
+		if (pyramid[i].fboID && pyramid[i].width == w && pyramid[i].height == h)
+			continue;
+		if (pyramid[i].fboID)
+			DestroyTexture(&pyramid[i]);
+		success = InitializeFBO(&pyramid[i], GL_TEXTURE_2D, w, h) && success;
 	}
-	else
-	{
-	glBindTexture(GL_TEXTURE_2D, tex->textureID);
-//	glBindFramebuffer(GL_FRAMEBUFFER, oldText.textureID);
-	
-	glUseProgram(program);
-	glUniform1i(glGetUniformLocation(program,"mode"), mode);
-	glUniform1i(glGetUniformLocation(program,"filt"), filt);
-	glUniform1i(glGetUniformLocation(program,"w"), tex->width);
-	glUniform1i(glGetUniformLocation(program,"h"), tex->height);
-	glUniform1i(glGetUniformLocation(program,"gSize"), gaus);
-	glUniform1i(glGetUniformLocation(program,"level"), level);
-	glUniform1i(glGetUniformLocation(program,"hori"), 0);
-	glBindVertexArray(geometry->vertexArray);
+	return success;
+}
 
-	
-	glDrawArrays(GL_TRIANGLES, 0, geometry->elementCount);}
-//	cout << geometry->elementCount << endl;
-//	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+// dual Kawase blur: downsample through filt levels, then upsample back up,
+// the last upsample into the chain's first target at the source size;
+// returns tex itself when there are no levels
+MyTexture* FilterPyramid(Geometry *fbogeo, MyTexture *tex)
+{
+	int levels = std::min(filt, PYRAMID_LEVELS);
+	if (levels == 0)
+		return tex;
+	if (!InitializePyramid(tex) || !InitializeFBOChain(&chain, tex->width, tex->height)) {
+		cout << "Failed to initialize pyramid levels" << endl;
+		return tex;
+	}
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	GLuint program = UseProgram(mode, filt, gaus);
+	CachedUniform1i(program, "mode", mode);
+	CachedUniform1i(program, "filt", filt);
+	CachedUniformMatrix3fv(program, "transform", identityTransform);
+	CachedBindVertexArray(fbogeo->vertexArray);
+
+	MyTexture *source = tex;
+	for (int i=0; i<levels; i++) {
+		CachedBindFramebuffer(pyramid[i].fboID);
+		glViewport(0, 0, pyramid[i].width, pyramid[i].height);
+		CachedBindTexture(0, source->textureID);
+		CachedUniform1i(program, "w", source->width);
+		CachedUniform1i(program, "h", source->height);
+		CachedUniform1i(program, "hori", 1);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		CountGLCalls(2);
+		source = &pyramid[i];
+	}
+	// back up through every level: the result is the last upsample, from
+	// pyramid[0], not the coarsest level the downsample loop ended on
+	for (int i=levels-1; i>=0; i--) {
+		MyTexture *target = i > 0 ? &pyramid[i-1] : &chain.targets[0];
+		CachedBindFramebuffer(target->fboID);
+		glViewport(0, 0, target->width, target->height);
+		CachedBindTexture(0, pyramid[i].textureID);
+		CachedUniform1i(program, "w", pyramid[i].width);
+		CachedUniform1i(program, "h", pyramid[i].height);
+		CachedUniform1i(program, "hori", 0);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		CountGLCalls(2);
+	}
+	CachedBindFramebuffer(0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	CountGLCalls(2);
+	return &chain.targets[0];
+}
 
-	// reset state to default (no shader or geometry bound)
-	glBindVertexArray(0);
-	glUseProgram(0);
+// compute-shader convolution for modes 1-3, chosen with --compute
+bool useCompute = false;
+MyCompute compute;
 
+// runs the current filter over tex at its own resolution, independent of
+// the view; returns the texture holding the result, tex itself for modes
+// that leave it unfiltered
+MyTexture* FilterOnGPU(Geometry *fbogeo, MyTexture *tex)
+{
+	if (useCompute && ComputeSupports(mode, filt))
+		return RunCompute(&compute, tex, mode, filt, gaus);
+	if (mode == 5)
+		return FilterPyramid(fbogeo, tex);
+	if (get<0>(VariantKey(mode, filt, gaus)) < 0)
+		return tex;
+
+	vector<MyPass> passes;
+	if (mode == 3) {
+		// horizontal then vertical
+		MyPass horizontal = { mode, filt, gaus, 1 };
+		MyPass vertical = { mode, filt, gaus, 0 };
+		passes.push_back(horizontal);
+		passes.push_back(vertical);
+	}
+	else {
+		MyPass pass = { mode, filt, gaus, 0 };
+		passes.push_back(pass);
+	}
+	return RunFBOChain(&chain, fbogeo->vertexArray, tex, passes, ChainProgram);
+}
 
+// filtered images by source and filter, so revisiting a combination skips
+// the filter; --cache-mb sets its budget
+MyResultCache results;
+// what's on screen, so view changes (pan, zoom, rotate) only resample it
+// and the cache is consulted only when one of these changes
+MyResultKey filteredKey = { 0, 0, 0, 0, 0, false };
+MyTexture *filtered = 0;
+
+// draws tex filtered, or the placeholder when tex is 0 (not loaded yet)
+void RenderScene(Geometry *geometry,Geometry *fbogeo, MyTexture *tex)
+{
+	MyTexture *shown = &placeholder;
+	if (tex) {
+		MyResultKey key = { tex->textureID, mode, filt, gaus, level, linearSampling };
+		if (!filtered || !(key == filteredKey)) {
+			filtered = FindResult(&results, key);
+			if (!filtered) {
+				filtered = FilterOnGPU(fbogeo, tex);
+				// unfiltered modes show the source itself
+				if (filtered != tex)
+					filtered = StoreResult(&results, key, filtered);
+			}
+			filteredKey = key;
+		}
+		shown = filtered;
+	}
+
+	// clear screen to a dark grey colour
+	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	CountGLCalls(2);
+
+	// the result is already filtered, so the fragment shader just samples
+	// it through the view transform
+	GLuint program = UseProgram(-1, 0, 0);
+	CachedBindTexture(0, shown->textureID);
+	CachedUniform1i(program, "mode", -1);
+	CachedUniform1i(program, "w", shown->width);
+	CachedUniform1i(program, "h", shown->height);
+	SetViewTransform(program);
+	CachedBindVertexArray(geometry->vertexArray);
+	glDrawArrays(GL_TRIANGLES, 0, geometry->elementCount);
+	CountGLCalls();
 
 	// check for an report any OpenGL errors
 	CheckGLErrors();
 }
 
+// --------------------------------------------------------------------------
+// On-demand rendering: input that changes what is drawn sets sceneDirty,
+// and the main loop sleeps in glfwWaitEvents while it is clear; with
+// --continuous it redraws every vsync instead
+
+bool continuous = false;
+bool sceneDirty = true;
+// the window lost its contents (uncovered) but nothing drawn has changed
+bool refreshNeeded = false;
+// copy of the last frame drawn, to re-present without redrawing
+MyTexture lastFrame;
+
+// copies the back buffer into lastFrame (save) or lastFrame back into the
+// back buffer; returns false when there is no frame of the window's size
+bool CopyFrame(GLFWwindow* window, bool save)
+{
+	int width, height;
+	glfwGetFramebufferSize(window, &width, &height);
+	if (save && (lastFrame.width != width || lastFrame.height != height || !lastFrame.fboID)) {
+		if (lastFrame.fboID)
+			DestroyTexture(&lastFrame);
+		if (!InitializeFBO(&lastFrame, GL_TEXTURE_2D, width, height))
+			return false;
+	}
+	if (!lastFrame.fboID || lastFrame.width != width || lastFrame.height != height)
+		return false;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, save ? 0 : lastFrame.fboID);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, save ? lastFrame.fboID : 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	InvalidateGLState();
+	return !CheckGLErrors();
+}
+
+// --------------------------------------------------------------------------
+// Export: E writes the filtered picture, at its own resolution, to
+// export_<n>.<format> in the background; X cycles the format
+
+MyExporter exporter;
+ExportFormat exportFormat = EXPORT_PNG;
+bool exportRequested = false;
+int exportCount = 0;
+
+void ExportResult(MyTexture *result)
+{
+	ostringstream filename;
+	filename << "export_" << exportCount << "." << ExportExtension(exportFormat);
+	if (StartExport(&exporter, result, filename.str(), exportFormat))
+		exportCount++;
+	else
+		cout << "Export of " << filename.str() << " failed or is busy, try again" << endl;
+}
+
 // --------------------------------------------------------------------------
 // GLFW callback functions
 
@@ -352,6 +631,8 @@ void ErrorCallback(int error, const char* description)
 // handles keyboard input events
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+	if (action == GLFW_PRESS)
+		sceneDirty = true;
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GL_TRUE);
 	if (key == GLFW_KEY_1 && action == GLFW_PRESS && mode != 0) {
@@ -379,6 +660,11 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		filt = 0;
 		gaus = 3;
 	}
+	if (key == GLFW_KEY_6 && action == GLFW_PRESS && mode != 5) {
+		mode = 5;
+		filt = 3;
+		gaus = 3;
+	}
 	if (key == GLFW_KEY_UP && action == GLFW_PRESS) {
 		if (mode == 0) {
 			if (filt == 5) 
@@ -425,6 +711,12 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 			else
 				filt++;
 		}		
+		if (mode == 5) {
+			if (filt == PYRAMID_LEVELS)
+				filt = 0;
+			else
+				filt++;
+		}
 	}
 	if (key == GLFW_KEY_DOWN && action == GLFW_PRESS) {
 		if (mode == 0) {
@@ -472,6 +764,12 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 			else
 				filt--;
 		}		
+		if (mode == 5) {
+			if (filt == 0)
+				filt = PYRAMID_LEVELS;
+			else
+				filt--;
+		}
 	}
 	
 	if (key == GLFW_KEY_RIGHT && action == GLFW_PRESS) {
@@ -530,6 +828,14 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		scalar=1;
 		filt=0;
 	}
+	if (key == GLFW_KEY_L && action == GLFW_PRESS)
+		linearSampling = !linearSampling;
+	if (key == GLFW_KEY_E && action == GLFW_PRESS)
+		exportRequested = true;
+	if (key == GLFW_KEY_X && action == GLFW_PRESS) {
+		exportFormat = (ExportFormat)((exportFormat + 1) % EXPORT_FORMATS);
+		cout << "Exporting as " << ExportExtension(exportFormat) << endl;
+	}
 	if (key == GLFW_KEY_UP && action == GLFW_PRESS)
 		if (mode == 3)
 			rel = true;
@@ -548,11 +854,13 @@ void cursor_position_callback(GLFWwindow* window, double xpos, double ypos) {
 		dy0 = y_ogl-yclick;
 		dx = (cos(-th)*(dx0)-sin(-th)*(dy0));
 		dy = (sin(-th)*(dx0)+cos(-th)*(dy0));
+		sceneDirty = true;
 	}	
 }
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 {
 	double x, y;
+	sceneDirty = true;
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
 	{	
 		glfwGetCursorPos(window, &x, &y);
@@ -594,6 +902,7 @@ double scaleLimit = 1;
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
 	double temp;
+	sceneDirty = true;
 	if (rclickdown) {
 		th = th + yoffset*(M_PI/60);
 	}
@@ -611,6 +920,12 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 	scalar = 1;
 }
 
+// the window was uncovered; show the last frame again
+void refresh_callback(GLFWwindow* window)
+{
+	refreshNeeded = true;
+}
+
 
 
 // ==========================================================================
@@ -620,6 +935,28 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 
 int main(int argc, char *argv[])
 {
+	// batch mode runs on the CPU engine, without a window
+	if (argc > 1 && string(argv[1]) == "--batch") {
+		MyBatchSpec spec;
+		if (argc != 5 || !ParseBatchSpec(&spec, argv[3])) {
+			cout << "Usage: " << argv[0] << " --batch <in dir> <mode:filt[:gSize[:method]]> <out dir>" << endl
+				<< "  mode 0-4 and filt as the number keys and arrows pick them, method one of" << endl
+				<< "  direct, recursive, box or fft (modes 2 and 3)" << endl;
+			return -1;
+		}
+		return RunBatch(argv[2], spec, argv[4]) == 0 ? 0 : -1;
+	}
+	if (argc > 1 && string(argv[1]) == "--sequence") {
+		MyBatchSpec spec;
+		if (argc != 5 || !ParseBatchSpec(&spec, argv[3])) {
+			cout << "Usage: " << argv[0] << " --sequence <frames> <mode:filt[:gSize[:method]]> <output>" << endl
+				<< "  frames and output are a .ppm or (input only) .y4m stream, or a numbered" << endl
+				<< "  PNG pattern like frames/frame_%04d.png" << endl;
+			return -1;
+		}
+		return RunSequence(argv[2], spec, argv[4]) == 0 ? 0 : -1;
+	}
+
 	// initialize the GLFW windowing system
 	if (!glfwInit()) {
 		cout << "ERROR: GLFW failed to initialize, TERMINATING" << endl;
@@ -627,14 +964,29 @@ int main(int argc, char *argv[])
 	}
 	glfwSetErrorCallback(ErrorCallback);
 
-	// attempt to create a window with an OpenGL 4.1 core profile context
+	for (int i=1; i<argc; i++)
+		if (string(argv[i]) == "--compute")
+			useCompute = true;
+		else if (string(argv[i]) == "--continuous")
+			continuous = true;
+		else if (string(argv[i]) == "--cache-mb" && i+1 < argc)
+			SetResultCacheBudget(&results, (size_t)std::max(0, atoi(argv[++i])) << 20);
+		else if (string(argv[i]) == "--no-pixel-cache")
+			SetPixelCacheEnabled(false);
+
+	// attempt to create a window with an OpenGL 4.1 core profile context,
+	// or 4.3 for the compute path, falling back to 4.1 if that fails
 	GLFWwindow *window = 0;
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, useCompute ? 3 : 1);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	int width = 512, height = 512;
 	window = glfwCreateWindow(width, height, "CPSC 453 OpenGL Boilerplate", 0, 0);
+	if (!window && useCompute) {
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+		window = glfwCreateWindow(width, height, "CPSC 453 OpenGL Boilerplate", 0, 0);
+	}
 	if (!window) {
 		cout << "Program failed to create GLFW window, TERMINATING" << endl;
 		glfwTerminate();
@@ -646,6 +998,7 @@ int main(int argc, char *argv[])
 	glfwSetCursorPosCallback(window, cursor_position_callback);
 	glfwSetMouseButtonCallback(window, mouse_button_callback);
 	glfwSetScrollCallback(window, scroll_callback);
+	glfwSetWindowRefreshCallback(window, refresh_callback);
 	glfwMakeContextCurrent(window);
 	
 	glfwSetCursorPos(window, 256,256);
@@ -666,6 +1019,16 @@ int main(int argc, char *argv[])
 		cout << "Program could not initialize shaders, TERMINATING" << endl;
 		return -1;
 	}
+	// specialize the cheap per-texel filters up front; kernel sizes of
+	// modes 2 and 3 are built the first time they are drawn
+	const int filters[6] = { 5, 3, 0, 0, 3, 0 };
+	for (int m=0; m<6; m++)
+		for (int f=0; f<=filters[m]; f++)
+			UseProgram(m, f, 0);
+	if (useCompute && !InitializeCompute(&compute)) {
+		cout << "Compute shaders unavailable, using fragment shaders" << endl;
+		useCompute = false;
+	}
 //	GLuint fbName = 0;
 //	oldText.textureID = fbName;
 //	glGenFramebuffers(1, &fbName);
@@ -679,21 +1042,19 @@ int main(int argc, char *argv[])
 //	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 //		cout << "dfddf" <<endl;
 
-	for (int i=0; i<6; i++) {
-		if (!InitializeTexture(&texs[i], pics[i], GL_TEXTURE_2D))
-			cout << "Program failed to initialize texture" << endl;
-//		if (!InitializeTexture(&oldText[i], pics[i], GL_TEXTURE_2D, true))
-//			cout << "Program failed to initialize texture" << endl;
-		//		else cout<<"good"<<endl;
-	}
-
+	// only the first picture is decoded now, in the background while the
+	// border loads; the rest wait until they are shown
+	for (int i=0; i<6; i++)
+		InitializeLazyTexture(&texs[i], pics[i]);
+	if (!InitializeUploadBuffers(&uploads))
+		cout << "Pixel buffers unavailable, uploading from client memory" << endl;
+	RequestTexture(&texs[pic], &uploads);
+	if (!InitializeExporter(&exporter))
+		cout << "Program failed to initialize exporter" << endl;
 	if (!InitializeTexture(&border, "blood2.png", GL_TEXTURE_2D))
-			cout << "Program failed to initialize texture" << endl;
-
-	if (!InitializeFBO(&oldText, GL_TEXTURE_2D))
-		cout << "Program failed to initialize rendered texture" << endl;
-	else
-		cout << "good fbo" << endl;
+		cout << "Program failed to initialize texture" << endl;
+	if (!InitializeSolidTexture(&placeholder, 128))
+		cout << "Program failed to initialize texture" << endl;
 
 
 	float img_h = (float)texs[pic].height/2;
@@ -704,15 +1065,6 @@ int main(int argc, char *argv[])
 	corners[2] =  coordx, corners[3] =  coordy,
 	corners[4] = -coordx, corners[5] =  coordy,
 	corners[6] =  coordx, corners[7] = -coordy;
-	// three vertex positions and assocated colours of a triangle
-	vec2 vertices[] = {
-		vec2( corners[0], corners[1] ),
-		vec2( corners[2], corners[3] ),
-		vec2( corners[4], corners[5] ),
-		vec2( corners[0], corners[1] ),
-		vec2( corners[2], corners[3] ),
-		vec2( corners[6], corners[7] )
-	};
 	vec3 colours[] = {
 		vec3( 1.0f, 0.0f, 0.0f ),
 		vec3( 0.0f, 1.0f, 0.0f ),
@@ -745,7 +1097,9 @@ int main(int argc, char *argv[])
 	if (!InitializeVAO(&geometry))
 		cout << "Program failed to intialize geometry!" << endl;
 
-	if(!LoadGeometry(&geometry, vertices, colours, textures, 6))
+	// both are the unit quad: vertex.glsl places the image on screen with
+	// the view transform, and offscreen passes draw it untransformed
+	if(!LoadGeometry(&geometry, fbos, colours, textures, 6))
 		cout << "Failed to load geometry" << endl;
 	if (!InitializeVAO(&fbogeo))
 		cout << "Program failed to intialize geometry!" << endl;
@@ -753,63 +1107,78 @@ int main(int argc, char *argv[])
 	if(!LoadGeometry(&fbogeo, fbos, colours, textures, 6))
 		cout << "Failed to load geometry" << endl;
 
-	glUseProgram(program);
-
-	glUniform1i(glGetUniformLocation(program, "ourTexture"), 0);
-	glUniform1i(glGetUniformLocation(program, "borderTexture"), 1);
-	glActiveTexture(GL_TEXTURE0 + 0);
-	glBindTexture(GL_TEXTURE_2D, texs[pic].textureID);
-	glActiveTexture(GL_TEXTURE0 + 1);
-	glBindTexture(GL_TEXTURE_2D, border.textureID);
-	
+	int frameCalls = -1;
+	// the last frame showed the placeholder for a picture still decoding
+	bool waiting = false;
 	while (!glfwWindowShouldClose(window))
 	{
-//		GLuint fbName = 0;
-//		oldText[pic].textureID = fbName;
-//		oldText.textureID = fbName;
-//		glGenFramebuffers(1, &fbName);
-//		glBindFramebuffer(GL_FRAMEBUFFER, fbName);
-//		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		
-	vertices[0] = vec2( cos(th)*(corners[0]*scalar+dx)-sin(th)*(corners[1]*scalar+dy), sin(th)*(corners[0]*scalar+dx)+cos(th)*(corners[1]*scalar+dy) );
-	vertices[1] = vec2( cos(th)*(corners[2]*scalar+dx)-sin(th)*(corners[3]*scalar+dy), sin(th)*(corners[2]*scalar+dx)+cos(th)*(corners[3]*scalar+dy) );
-	vertices[2] = vec2( cos(th)*(corners[4]*scalar+dx)-sin(th)*(corners[5]*scalar+dy), sin(th)*(corners[4]*scalar+dx)+cos(th)*(corners[5]*scalar+dy) );
-	vertices[3] = vec2( cos(th)*(corners[0]*scalar+dx)-sin(th)*(corners[1]*scalar+dy), sin(th)*(corners[0]*scalar+dx)+cos(th)*(corners[1]*scalar+dy) );
-	vertices[4] = vec2( cos(th)*(corners[2]*scalar+dx)-sin(th)*(corners[3]*scalar+dy), sin(th)*(corners[2]*scalar+dx)+cos(th)*(corners[3]*scalar+dy) );
-	vertices[5] = vec2( cos(th)*(corners[6]*scalar+dx)-sin(th)*(corners[7]*scalar+dy), sin(th)*(corners[6]*scalar+dx)+cos(th)*(corners[7]*scalar+dy) );
-	glActiveTexture(GL_TEXTURE0 + 0);
-	glBindTexture(GL_TEXTURE_2D, texs[pic].textureID);		
-	if (mode == 3)
-		if(!LoadGeometry(&fbogeo, fbos, colours, textures, 6))
-			cout << "Failed to load geometry" << endl;
-	if(!LoadGeometry(&geometry, vertices, colours, textures, 6))
-		cout << "Failed to load geometry" << endl;
-
-	// call function to draw our scene
-//		if (mode == 3)
-//			RenderTexture();
-		
-
-//		RenderScene(&geometry, &currentText, program);
-		//if (rel) {
-//			RenderTexture(&geometry);
-//			cout << "click" << endl;
-//		}
-		RenderScene(&geometry, &fbogeo, &texs[pic], program);
-//		if (mode ==2 && filt ==5) 
-//			RenderScene(&geometry, &border, program);
-		glfwSwapBuffers(window);
-
-		glfwPollEvents();
-
-//		rel = false;
+		if (continuous || sceneDirty) {
+			// call function to draw our scene
+			MyTexture *picture = RequestTexture(&texs[pic], &uploads);
+			RenderScene(&geometry, &fbogeo, picture);
+			// from what was drawn, not the decode's state now: a decode
+			// finishing since RequestTexture would otherwise leave the
+			// placeholder up with its wake-up already spent
+			waiting = picture == 0 && texs[pic].state != LAZY_FAILED;
+			if (exportRequested && picture)
+				ExportResult(filtered);
+			exportRequested = false;
+			// report the GL calls a frame costs whenever that changes
+			int issued, skipped;
+			EndGLFrame(&issued, &skipped);
+			if (issued != frameCalls) {
+				cout << "GL calls per frame: " << issued << " (" << skipped << " redundant skipped)" << endl;
+				frameCalls = issued;
+			}
+			if (!continuous)
+				CopyFrame(window, true);
+			glfwSwapBuffers(window);
+			sceneDirty = false;
+		}
+		else if (refreshNeeded) {
+			// nothing changed, so put the kept frame back rather than
+			// filtering again; redraw if there isn't one to show
+			if (CopyFrame(window, false))
+				glfwSwapBuffers(window);
+			else
+				sceneDirty = true;
+		}
+		refreshNeeded = false;
+
+		// readbacks are only checked on, never waited for, so keep waking
+		// up while one is in flight
+		PollExports(&exporter);
+		if (continuous || sceneDirty)
+			glfwPollEvents();
+		else if (ExportsPending(&exporter))
+			glfwWaitEventsTimeout(0.01);
+		else
+			glfwWaitEvents();
+		// woken by a finished decode: draw the picture it was waiting for
+		if (waiting && !LazyTexturePending(&texs[pic]))
+			sceneDirty = true;
 	}
 
 	// clean up allocated resources before exit
+	DestroyExporter(&exporter);
+	DestroyCompute(&compute);
+	cout << "Result cache: " << results.hits << " hits, " << results.misses << " misses, "
+		<< results.evictions << " evictions, " << (results.bytes >> 20) << " MB held" << endl;
+	// results are keyed by texture name, which GL recycles once deleted
+	for (int i=0; i<6; i++) {
+		ForgetResults(&results, texs[i].texture.textureID);
+		DestroyLazyTexture(&texs[i]);
+	}
+	DestroyResultCache(&results);
+	DestroyFBOChain(&chain);
+	if (lastFrame.fboID)
+		DestroyTexture(&lastFrame);
+	DestroyTexture(&border);
+	DestroyTexture(&placeholder);
+	DestroyUploadBuffers(&uploads);
 	DestroyGeometry(&geometry);
 //	DestroyTexGeometry(&geometry);
-	glUseProgram(0);
-	glDeleteProgram(program);
+	DestroyShaders();
 	glfwDestroyWindow(window);
 	glfwTerminate();
 
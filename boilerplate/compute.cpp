@@ -0,0 +1,190 @@
+#include "compute.h"
+#include "gaussian.h"
+#include "glstate.h"
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// shader helpers from boilerplate.cpp and texture.cpp
+string LoadSource(const string &filename);
+GLuint CompileShader(GLenum shaderType, const string &source);
+bool CheckGLErrors(const char* errorLocation);
+
+// --------------------------------------------------------------------------
+// GL 4.3 entry points and enums; the bundled glad loader stops at 4.0
+
+#define GL_COMPUTE_SHADER					0x91B9
+#define GL_TEXTURE_FETCH_BARRIER_BIT		0x00000008
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT	0x00000020
+
+typedef void (APIENTRYP DispatchComputeProc)(GLuint x, GLuint y, GLuint z);
+typedef void (APIENTRYP BindImageTextureProc)(GLuint unit, GLuint texture, GLint level,
+	GLboolean layered, GLint layer, GLenum access, GLenum format);
+typedef void (APIENTRYP MemoryBarrierProc)(GLbitfield barriers);
+
+static DispatchComputeProc dispatchCompute = 0;
+static BindImageTextureProc bindImageTexture = 0;
+static MemoryBarrierProc memoryBarrier = 0;
+
+// work group sizes, matching convolve.comp
+static const int TILE = 16;
+static const int LINE = 256;
+
+MyCompute::MyCompute() : tileProgram(0), lineProgram(0), weightFilt(-1), weightSize(-1)
+	{}
+
+// compiles convolve.comp with an optional #define after the #version line
+static GLuint BuildProgram(const string &source, const char* define)
+{
+	string text = source;
+	if (define) {
+		size_t line = text.find('\n', text.find("#version")) + 1;
+		text.insert(line, string("#define ") + define + "\n");
+	}
+	GLuint shader = CompileShader(GL_COMPUTE_SHADER, text);
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status == GL_FALSE) {
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glLinkProgram(program);
+	glDeleteShader(shader);
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE) {
+		GLint length;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+		string info(length, ' ');
+		glGetProgramInfoLog(program, info.length(), &length, &info[0]);
+		cout << "ERROR linking compute program:" << endl << info << endl;
+		glDeleteProgram(program);
+		return 0;
+	}
+	CacheUniformLocations(program);
+	return program;
+}
+
+bool InitializeCompute(MyCompute* compute)
+{
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major < 4 || (major == 4 && minor < 3)) {
+		cout << "Compute shaders need OpenGL 4.3, context is " << major << "." << minor << endl;
+		return false;
+	}
+	dispatchCompute = (DispatchComputeProc)glfwGetProcAddress("glDispatchCompute");
+	bindImageTexture = (BindImageTextureProc)glfwGetProcAddress("glBindImageTexture");
+	memoryBarrier = (MemoryBarrierProc)glfwGetProcAddress("glMemoryBarrier");
+	if (!dispatchCompute || !bindImageTexture || !memoryBarrier)
+		return false;
+
+	string source = LoadSource("shaders/convolve.comp");
+	if (source.empty())
+		return false;
+	compute->tileProgram = BuildProgram(source, 0);
+	compute->lineProgram = BuildProgram(source, "LINE_PASS");
+	if (!compute->tileProgram || !compute->lineProgram) {
+		DestroyCompute(compute);
+		return false;
+	}
+	return !CheckGLErrors("Initializing compute: ");
+}
+
+bool ComputeSupports(int mode, int filt)
+{
+	return (mode == 1 && filt >= 1 && filt <= 3) || ((mode == 2 || mode == 3) && filt != 0);
+}
+
+// (re)allocates an RGBA8 image texture when the size changes
+static void ResizeImageTexture(MyTexture* texture, int width, int height)
+{
+	if (texture->textureID && texture->width == width && texture->height == height)
+		return;
+	if (!texture->textureID)
+		glGenTextures(1, &texture->textureID);
+	texture->target = GL_TEXTURE_2D;
+	texture->width = width;
+	texture->height = height;
+	CachedActiveTexture(0);
+	glBindTexture(GL_TEXTURE_2D, texture->textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	InvalidateGLState();
+}
+
+static void UploadWeights(MyCompute* compute, int filt, int gSize)
+{
+	if (filt == compute->weightFilt && gSize == compute->weightSize)
+		return;
+	int bound = std::max(0, std::min((gSize-1)/2, GAUSSIAN_MAX_RADIUS));
+	vector<float> kernel = GaussianKernel(FilterSigma(filt), bound);
+	GLuint programs[2] = { compute->tileProgram, compute->lineProgram };
+	for (int i=0; i<2; i++) {
+		CachedUseProgram(programs[i]);
+		CachedUniform1fv(programs[i], "weights", bound+1, &kernel[bound]);
+	}
+	compute->weightFilt = filt;
+	compute->weightSize = gSize;
+}
+
+// one dispatch of program reading source into target
+static void Dispatch(GLuint program, MyTexture* source, MyTexture* target,
+	int mode, int filt, int gSize, int hori, int groupsX, int groupsY)
+{
+	CachedUseProgram(program);
+	CachedUniform1i(program, "mode", mode);
+	CachedUniform1i(program, "filt", filt);
+	CachedUniform1i(program, "gSize", gSize);
+	CachedUniform1i(program, "hori", hori);
+	CachedUniform1i(program, "ourTexture", 0);
+	CachedUniform1i(program, "result", 0);
+	CachedBindTexture(0, source->textureID);
+	bindImageTexture(0, target->textureID, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	dispatchCompute(groupsX, groupsY, 1);
+	// the next pass, or the draw, reads what this one wrote
+	memoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	CountGLCalls(3);
+}
+
+MyTexture* RunCompute(MyCompute* compute, MyTexture* source, int mode, int filt, int gSize)
+{
+	int width = source->width, height = source->height;
+	ResizeImageTexture(&compute->result, width, height);
+	UploadWeights(compute, filt, gSize);
+
+	if (mode == 3) {
+		ResizeImageTexture(&compute->intermediate, width, height);
+		Dispatch(compute->lineProgram, source, &compute->intermediate, mode, filt, gSize, 1,
+			(width + LINE - 1)/LINE, height);
+		Dispatch(compute->lineProgram, &compute->intermediate, &compute->result, mode, filt, gSize, 0,
+			(height + LINE - 1)/LINE, width);
+	}
+	else {
+		Dispatch(compute->tileProgram, source, &compute->result, mode, filt, gSize, 0,
+			(width + TILE - 1)/TILE, (height + TILE - 1)/TILE);
+	}
+	CheckGLErrors("Running compute: ");
+	return &compute->result;
+}
+
+void DestroyCompute(MyCompute* compute)
+{
+	GLuint programs[2] = { compute->tileProgram, compute->lineProgram };
+	for (int i=0; i<2; i++) {
+		if (!programs[i]) continue;
+		ForgetProgram(programs[i]);
+		glDeleteProgram(programs[i]);
+	}
+	compute->tileProgram = compute->lineProgram = 0;
+	if (compute->result.textureID) DestroyTexture(&compute->result);
+	if (compute->intermediate.textureID) DestroyTexture(&compute->intermediate);
+	compute->weightFilt = compute->weightSize = -1;
+}
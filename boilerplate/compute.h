@@ -0,0 +1,32 @@
+#pragma once
+#include "texture.h"
+
+// --------------------------------------------------------------------------
+// Compute-shader path for the convolutions of modes 1-3 (GL 4.3+), using
+// shaders/convolve.comp
+
+struct MyCompute
+{
+	GLuint tileProgram;		// 16x16 tiles: mode 1 stencils, mode 2 Gaussian
+	GLuint lineProgram;		// 256 texel lines: mode 3's two passes
+	MyTexture result;		// RGBA8 output, sized to the last source
+	MyTexture intermediate;	// mode 3's horizontal pass
+	int weightFilt;			// kernel currently in both programs' weights[]
+	int weightSize;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyCompute();
+};
+
+// loads the GL 4.3 entry points and builds both programs; returns false
+// (leaving the fragment path in use) when the context can't run them
+bool InitializeCompute(MyCompute* compute);
+
+// whether mode/filt has a compute version
+bool ComputeSupports(int mode, int filt);
+
+// filters source into compute->result and returns it, ready to sample
+MyTexture* RunCompute(MyCompute* compute, MyTexture* source, int mode, int filt, int gSize);
+
+// deallocate programs and textures
+void DestroyCompute(MyCompute* compute);
@@ -0,0 +1,182 @@
+#include "export.h"
+#include "glstate.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image_write.h>
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+using namespace std;
+
+bool CheckGLErrors(const char* errorLocation);
+
+MyExporter::MyExporter() : readFramebuffer(0), stopping(false)
+{
+	for (int i=0; i<EXPORT_BUFFERS; i++) {
+		buffers[i] = 0;
+		fences[i] = 0;
+	}
+}
+
+const char* ExportExtension(ExportFormat format)
+{
+	switch (format) {
+	case EXPORT_TGA: return "tga";
+	case EXPORT_BMP: return "bmp";
+	case EXPORT_HDR: return "hdr";
+	default: return "png";
+	}
+}
+
+// writes one job, flipped to the top-down rows image files expect
+static bool Encode(MyExportJob* job)
+{
+	int stride = 4*job->width;
+	vector<unsigned char> flipped(job->pixels.size());
+	for (int y=0; y<job->height; y++)
+		copy(job->pixels.begin() + (size_t)y*stride, job->pixels.begin() + (size_t)(y+1)*stride,
+			flipped.begin() + (size_t)(job->height - 1 - y)*stride);
+	const char *name = job->filename.c_str();
+	switch (job->format) {
+	case EXPORT_TGA:
+		return stbi_write_tga(name, job->width, job->height, 4, &flipped[0]) != 0;
+	case EXPORT_BMP:
+		return stbi_write_bmp(name, job->width, job->height, 4, &flipped[0]) != 0;
+	case EXPORT_HDR: {
+		vector<float> linear(flipped.size());
+		for (size_t i=0; i<flipped.size(); i++)
+			linear[i] = flipped[i]/255.0f;
+		return stbi_write_hdr(name, job->width, job->height, 4, &linear[0]) != 0;
+	}
+	default:
+		return stbi_write_png(name, job->width, job->height, 4, &flipped[0], stride) != 0;
+	}
+}
+
+static void EncoderLoop(MyExporter* exporter)
+{
+	for (;;) {
+		MyExportJob job;
+		{
+			unique_lock<mutex> lock(exporter->lock);
+			exporter->queued.wait(lock, [exporter] { return exporter->stopping || !exporter->jobs.empty(); });
+			if (exporter->jobs.empty())
+				return;
+			job = move(exporter->jobs.front());
+			exporter->jobs.pop_front();
+		}
+		if (Encode(&job))
+			cout << "Exported " << job.filename << endl;
+		else
+			cout << "Failed to write " << job.filename << endl;
+	}
+}
+
+bool InitializeExporter(MyExporter* exporter)
+{
+	glGenBuffers(EXPORT_BUFFERS, exporter->buffers);
+	glGenFramebuffers(1, &exporter->readFramebuffer);
+	exporter->stopping = false;
+	exporter->encoder = thread(EncoderLoop, exporter);
+	return !CheckGLErrors("Initializing exporter: ");
+}
+
+bool StartExport(MyExporter* exporter, MyTexture* texture, const string& filename,
+	ExportFormat format)
+{
+	int slot = -1;
+	for (int i=0; i<EXPORT_BUFFERS && slot < 0; i++)
+		if (!exporter->fences[i])
+			slot = i;
+	if (slot < 0 || !exporter->buffers[slot])
+		return false;
+
+	MyExportJob &job = exporter->reading[slot];
+	job.filename = filename;
+	job.format = format;
+	job.width = texture->width;
+	job.height = texture->height;
+	size_t size = (size_t)4*texture->width*texture->height;
+
+	// the texture may not have a framebuffer of its own (a picture, or the
+	// compute path's result), so read it through ours
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, exporter->readFramebuffer);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture->textureID, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, exporter->buffers[slot]);
+	glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+	// into the buffer, so this returns without waiting for the GPU
+	glReadPixels(0, 0, texture->width, texture->height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	exporter->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	CountGLCalls(9);
+	InvalidateGLState();
+	return !CheckGLErrors("Starting export: ");
+}
+
+void PollExports(MyExporter* exporter)
+{
+	for (int i=0; i<EXPORT_BUFFERS; i++) {
+		if (!exporter->fences[i])
+			continue;
+		// a zero timeout only asks, never blocks; the flush makes sure the
+		// fence gets to the GPU at all
+		GLenum status = glClientWaitSync(exporter->fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		CountGLCalls();
+		if (status == GL_TIMEOUT_EXPIRED)
+			continue;
+		glDeleteSync(exporter->fences[i]);
+		exporter->fences[i] = 0;
+
+		MyExportJob &job = exporter->reading[i];
+		size_t size = (size_t)4*job.width*job.height;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, exporter->buffers[i]);
+		const unsigned char *pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size,
+			GL_MAP_READ_BIT);
+		if (pixels && status != GL_WAIT_FAILED) {
+			job.pixels.assign(pixels, pixels + size);
+			lock_guard<mutex> lock(exporter->lock);
+			exporter->jobs.push_back(move(job));
+			exporter->queued.notify_one();
+		}
+		else
+			cout << "Failed to read back " << job.filename << endl;
+		if (pixels)
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		CountGLCalls(5);
+	}
+}
+
+bool ExportsPending(const MyExporter* exporter)
+{
+	for (int i=0; i<EXPORT_BUFFERS; i++)
+		if (exporter->fences[i])
+			return true;
+	return false;
+}
+
+void DestroyExporter(MyExporter* exporter)
+{
+	// readbacks still in flight are waited out, so every export lands
+	while (ExportsPending(exporter)) {
+		for (int i=0; i<EXPORT_BUFFERS; i++)
+			if (exporter->fences[i])
+				glClientWaitSync(exporter->fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		PollExports(exporter);
+	}
+	if (exporter->encoder.joinable()) {
+		{
+			lock_guard<mutex> lock(exporter->lock);
+			exporter->stopping = true;
+		}
+		exporter->queued.notify_one();
+		exporter->encoder.join();
+	}
+	glDeleteBuffers(EXPORT_BUFFERS, exporter->buffers);
+	glDeleteFramebuffers(1, &exporter->readFramebuffer);
+	for (int i=0; i<EXPORT_BUFFERS; i++)
+		exporter->buffers[i] = 0;
+	exporter->readFramebuffer = 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "texture.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// --------------------------------------------------------------------------
+// Exporting filtered images without stalling the render thread: the texture
+// is read into a pixel pack buffer with a fence behind it, the pixels are
+// fetched once the fence has passed, and a background thread encodes them
+// with stb_image_write
+
+#define EXPORT_BUFFERS 2
+
+enum ExportFormat
+{
+	EXPORT_PNG,
+	EXPORT_TGA,
+	EXPORT_BMP,
+	EXPORT_HDR,
+	EXPORT_FORMATS
+};
+
+// one image on its way out, RGBA8 with rows bottom-up as GL reads them
+struct MyExportJob
+{
+	std::string filename;
+	ExportFormat format;
+	int width;
+	int height;
+	std::vector<unsigned char> pixels;
+};
+
+struct MyExporter
+{
+	GLuint buffers[EXPORT_BUFFERS];
+	GLsync fences[EXPORT_BUFFERS];		// 0 when the buffer is free
+	MyExportJob reading[EXPORT_BUFFERS];	// what each buffer is reading
+	GLuint readFramebuffer;
+
+	std::thread encoder;
+	std::mutex lock;
+	std::condition_variable queued;
+	std::deque<MyExportJob> jobs;
+	bool stopping;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyExporter();
+};
+
+// "png", "tga", "bmp" or "hdr"
+const char* ExportExtension(ExportFormat format);
+
+// creates the buffers and starts the encoder thread
+bool InitializeExporter(MyExporter* exporter);
+
+// queues a readback of texture to be written to filename; returns false
+// when both buffers are still in flight
+bool StartExport(MyExporter* exporter, MyTexture* texture, const std::string& filename,
+	ExportFormat format);
+
+// hands any finished readbacks to the encoder without waiting on the GPU;
+// call once per loop iteration
+void PollExports(MyExporter* exporter);
+
+// whether a readback is still waiting on the GPU
+bool ExportsPending(const MyExporter* exporter);
+
+// finishes every export, then stops the encoder and deallocates the buffers
+void DestroyExporter(MyExporter* exporter);
@@ -1,102 +1,78 @@
-/*#include "fbo.h"
-#include "texture.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb/stb_image.h>
+#include "fbo.h"
+#include "glstate.h"
 #include <iostream>
-#include <string>
 
 using namespace std;
 
-bool CheckGLErrors(const char* errorLocation)
+bool CheckGLErrors(const char* errorLocation);
+
+MyFBOChain::MyFBOChain() : width(0), height(0)
+	{}
+
+bool InitializeFBOChain(MyFBOChain* chain, int width, int height)
 {
-	bool error = false;
-	for (GLenum flag = glGetError(); flag != GL_NO_ERROR; flag = glGetError())
-	{
-		cout << errorLocation;
-		switch (flag) {
-		case GL_INVALID_ENUM:
-			cout << "GL_INVALID_ENUM" << endl; break;
-		case GL_INVALID_VALUE:
-			cout << "GL_INVALID_VALUE" << endl; break;
-		case GL_INVALID_OPERATION:
-			cout << "GL_INVALID_OPERATION" << endl; break;
-		case GL_INVALID_FRAMEBUFFER_OPERATION:
-			cout << "GL_INVALID_FRAMEBUFFER_OPERATION" << endl; break;
-		case GL_OUT_OF_MEMORY:
-			cout << "GL_OUT_OF_MEMORY" << endl; break;
-		default:
-			cout << "[unknown error code]" << endl;
+	if (chain->width == width && chain->height == height && chain->targets[0].fboID)
+		return true;
+	DestroyFBOChain(chain);
+	for (int i=0; i<FBO_CHAIN_TARGETS; i++) {
+		if (!InitializeFBO(&chain->targets[i], GL_TEXTURE_2D, width, height)) {
+			cout << "Failed to initialize render target " << i << " of the chain" << endl;
+			DestroyFBOChain(chain);
+			return false;
 		}
-		error = true;
 	}
-	return error;
+	chain->width = width;
+	chain->height = height;
+	return true;
 }
 
-MyFBO::MyFBO() : textureID(0), target(0), width(0), height(0)
-	{}
-
-
-bool InitializeFBO(MyFBO* fbo, GLuint target, MyTexture *rendered) {
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);		//Set alignment to be 1
-
-		fbo->target = target;
-		glGenFramebuffers(1, &fbo->textureID);
-		glBindFramebuffer(fbo->target, fbo->textureID);
-		GLuint format = GL_RGB;
-		switch(numComponents)
-		{
-			case 4:
-				format = GL_RGBA;
-				break;
-			case 3:
-				format = GL_RGB;
-				break;
-			case 2:
-				format = GL_RG;
-				break;
-			case 1:
-				format = GL_RED;
-				break;
-			default:
-				cout << "Invalid Texture Format" << endl;
-				break;
-		};
-		
-		//GLuint renderedTexture;
-		glGenTextures(1, &rendered->target);
-
-		// "Bind" the newly created texture : all future texture functions will modify this texture
-		glBindTexture(rendered->target, rendered->textureID);
-		
-		// Give an empty image to OpenGL ( the last "0" )
-		glTexImage2D(texture->target, 0, format, rendered->width, rendered->height, 0, format, GL_UNSIGNED_BYTE, 0);
-
-		// Poor filtering. Needed !
-		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(texture->target, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(texture->target, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		
-		glTexImage2D(texture->target, 0, format, texture->width, texture->height, 0, format, GL_UNSIGNED_BYTE, data);
-
-		// Note: Only wrapping modes supported for GL_TEXTURE_RECTANGLE when defining
-		// GL_TEXTURE_WRAP are GL_CLAMP_TO_EDGE or GL_CLAMP_TO_BORDER
-		glTexParameteri(texture->target, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(texture->target, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+MyTexture* RunFBOChain(MyFBOChain* chain, GLuint quad, MyTexture* source,
+	const vector<MyPass>& passes, PassProgram programFor)
+{
+	if (passes.empty())
+		return source;
+	if (!InitializeFBOChain(chain, source->width, source->height))
+		return source;
 
-		// Clean up
-		glBindTexture(texture->target, 0);
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);	//Return to default alignment
-//		stbi_image_free(data);
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glViewport(0, 0, chain->width, chain->height);
+	CountGLCalls(2);
+	CachedBindVertexArray(quad);
 
-//		return !CheckGLErrors( (string("Loading texture: ")+filename).c_str() );
-		return true;
+	// passes cover the whole target, untransformed
+	static const float identity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+	MyTexture *input = source;
+	for (size_t i=0; i<passes.size(); i++) {
+		const MyPass &pass = passes[i];
+		MyTexture *output = &chain->targets[i % FBO_CHAIN_TARGETS];
+		CachedBindFramebuffer(output->fboID);
+		CachedBindTexture(0, input->textureID);
+		GLuint program = programFor(pass);
+		CachedUniformMatrix3fv(program, "transform", identity);
+		CachedUniform1i(program, "mode", pass.mode);
+		CachedUniform1i(program, "filt", pass.filt);
+		CachedUniform1i(program, "w", input->width);
+		CachedUniform1i(program, "h", input->height);
+		CachedUniform1i(program, "gSize", pass.gSize);
+		CachedUniform1i(program, "hori", pass.hori);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		CountGLCalls();
+		input = output;
+	}
 
+	CachedBindFramebuffer(0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	CountGLCalls();
+	CheckGLErrors("Running render target chain: ");
+	return input;
 }
 
-
-// deallocate texture-related objects
-void DestroyFBO(MyFBO *texture);
-*/
+void DestroyFBOChain(MyFBOChain* chain)
+{
+	for (int i=0; i<FBO_CHAIN_TARGETS; i++)
+		if (chain->targets[i].fboID)
+			DestroyTexture(&chain->targets[i]);
+	chain->width = 0;
+	chain->height = 0;
+}
@@ -1,21 +1,46 @@
-/*#pragma once
-#include <glad/glad.h>
-#include <GLFW/glfw3.h>
+#pragma once
+#include "texture.h"
+#include <vector>
 
+// --------------------------------------------------------------------------
+// Ping-pong render targets for running a stack of fragment-shader passes
+// offscreen: each pass reads the previous one's output and draws into the
+// other target, so any number of passes needs only two textures
 
-struct MyFBO
+#define FBO_CHAIN_TARGETS 2
+
+// one full-target draw of fragment.glsl
+struct MyPass
+{
+	int mode;
+	int filt;
+	int gSize;
+	int hori;
+};
+
+struct MyFBOChain
 {
-	GLuint textureID;
-	GLuint target;
+	MyTexture targets[FBO_CHAIN_TARGETS];
 	int width;
 	int height;
 
-	// initialize object names to zero (OpenGL reserved value)
-	MyFBO();
+	// initialize to no targets
+	MyFBOChain();
 };
 
-bool InitializeFBO(MyFBO* fbo, GLuint target = GL_TEXTURE_2D, MyTexture* rendered);
+// (re)allocates the targets at width x height; a no-op when they already
+// are that size, so it is safe to call every frame
+bool InitializeFBOChain(MyFBOChain* chain, int width, int height);
+
+// returns the program to draw a pass with, already in use and with any
+// uniforms the chain doesn't set itself (the Gaussian weights) uploaded
+typedef GLuint (*PassProgram)(const MyPass& pass);
+
+// draws passes in order over quad, a VAO covering clip space, starting
+// from source; returns the target holding the last pass, or source itself
+// when there are no passes
+MyTexture* RunFBOChain(MyFBOChain* chain, GLuint quad, MyTexture* source,
+	const std::vector<MyPass>& passes, PassProgram programFor);
 
-// deallocate texture-related objects
-void DestroyFBO(MyFBO *fbo);
-*/
+// deallocate the targets
+void DestroyFBOChain(MyFBOChain* chain);
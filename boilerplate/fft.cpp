@@ -0,0 +1,299 @@
+#include "fft.h"
+#include "threadpool.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <math.h>
+
+using namespace std;
+
+typedef complex<float> Complex;
+
+// columns gathered per task in the vertical passes, so the gathers read
+// whole cache lines from each row
+static const int COLUMN_BLOCK = 8;
+
+int FastFFTSize(int n)
+{
+	for (;; n++) {
+		int m = n;
+		while (m%2 == 0) m /= 2;
+		while (m%3 == 0) m /= 3;
+		while (m%5 == 0) m /= 5;
+		if (m <= 1)
+			return n;
+	}
+}
+
+static FFTPlan* CreatePlan(int n)
+{
+	FFTPlan *plan = new FFTPlan;
+	plan->n = n;
+	plan->twiddles.resize(n);
+	for (int k=0; k<n; k++) {
+		double phase = -2.0*M_PI*k/n;
+		plan->twiddles[k] = Complex((float)cos(phase), (float)sin(phase));
+	}
+	// radix 4 first, then 2, 3, 5, and any other primes
+	int p = 4, m = n;
+	while (m > 1) {
+		while (m%p) {
+			if (p == 4) p = 2;
+			else if (p == 2) p = 3;
+			else p += 2;
+			if (p*p > m) p = m;
+		}
+		m /= p;
+		plan->factors.push_back(p);
+		plan->factors.push_back(m);
+	}
+	return plan;
+}
+
+const FFTPlan* GetFFTPlan(int n)
+{
+	static mutex plansMutex;
+	static map<int, unique_ptr<FFTPlan> > plans;
+	lock_guard<mutex> lock(plansMutex);
+	unique_ptr<FFTPlan> &plan = plans[n];
+	if (!plan)
+		plan.reset(CreatePlan(n));
+	return plan.get();
+}
+
+// --------------------------------------------------------------------------
+// Decimation in time, recursing over the plan's factors
+
+// plain product, without std::complex's inf/nan recovery
+static inline Complex Mul(const Complex& a, const Complex& b)
+{
+	return Complex(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+}
+
+static void Butterfly2(Complex* out, const FFTPlan* plan, int fstride, int m)
+{
+	for (int k=0; k<m; k++) {
+		Complex t = Mul(out[m+k], plan->twiddles[k*fstride]);
+		out[m+k] = out[k] - t;
+		out[k] += t;
+	}
+}
+
+static void Butterfly4(Complex* out, const FFTPlan* plan, int fstride, int m)
+{
+	const Complex *tw = &plan->twiddles[0];
+	for (int k=0; k<m; k++) {
+		Complex s0 = Mul(out[k+m], tw[k*fstride]);
+		Complex s1 = Mul(out[k+2*m], tw[2*k*fstride]);
+		Complex s2 = Mul(out[k+3*m], tw[3*k*fstride]);
+		Complex s5 = out[k] - s1;
+		out[k] += s1;
+		Complex s3 = s0 + s2;
+		Complex s4 = s0 - s2;
+		out[k+2*m] = out[k] - s3;
+		out[k] += s3;
+		out[k+m] = Complex(s5.real() + s4.imag(), s5.imag() - s4.real());
+		out[k+3*m] = Complex(s5.real() - s4.imag(), s5.imag() + s4.real());
+	}
+}
+
+// twiddle each of the p inputs, then a size p DFT using the p-th roots
+static void ButterflyGeneric(Complex* out, const FFTPlan* plan, int fstride, int m, int p)
+{
+	Complex local[16];
+	vector<Complex> big;
+	Complex *s = local, *roots = local + 8;
+	if (p > 8) {
+		big.resize(2*p);
+		s = &big[0];
+		roots = &big[p];
+	}
+	for (int q=0; q<p; q++)
+		roots[q] = plan->twiddles[q*(plan->n/p)];
+	for (int u=0; u<m; u++) {
+		s[0] = out[u];
+		for (int q=1; q<p; q++)
+			s[q] = Mul(out[u + q*m], plan->twiddles[q*fstride*u]);
+		for (int q1=0; q1<p; q1++) {
+			Complex sum = s[0];
+			int root = 0;
+			for (int q=1; q<p; q++) {
+				root += q1;
+				if (root >= p) root -= p;
+				sum += Mul(s[q], roots[root]);
+			}
+			out[u + q1*m] = sum;
+		}
+	}
+}
+
+static void Work(Complex* out, const Complex* in, int fstride, const int* factors, const FFTPlan* plan)
+{
+	int p = factors[0], m = factors[1];
+	if (m == 1) {
+		for (int q=0; q<p; q++)
+			out[q] = in[q*fstride];
+	}
+	else {
+		for (int q=0; q<p; q++)
+			Work(out + q*m, in + q*fstride, fstride*p, factors + 2, plan);
+	}
+
+	if (p == 2)
+		Butterfly2(out, plan, fstride, m);
+	else if (p == 4)
+		Butterfly4(out, plan, fstride, m);
+	else
+		ButterflyGeneric(out, plan, fstride, m, p);
+}
+
+void FFT(const FFTPlan* plan, Complex* data, bool inverse, Complex* scratch)
+{
+	int n = plan->n;
+	if (n <= 1)
+		return;
+	// the inverse is conj(FFT(conj(x))), so only forward twiddles are kept
+	for (int i=0; i<n; i++)
+		scratch[i] = inverse ? conj(data[i]) : data[i];
+	Work(data, scratch, 1, &plan->factors[0], plan);
+	if (inverse)
+		for (int i=0; i<n; i++)
+			data[i] = conj(data[i]);
+}
+
+// --------------------------------------------------------------------------
+// Kernels
+
+MyKernel::MyKernel() : width(0), height(0)
+	{}
+
+bool InitializeKernel(MyKernel* kernel, int width, int height)
+{
+	if (width <= 0 || height <= 0 || width%2 == 0 || height%2 == 0)
+		return false;
+	kernel->width = width;
+	kernel->height = height;
+	kernel->weights.assign(width*height, 0.0f);
+	return true;
+}
+
+bool InitializeKernel(MyKernel* kernel, const vector<float>& separable)
+{
+	int size = (int)separable.size();
+	if (!InitializeKernel(kernel, size, size))
+		return false;
+	for (int j=0; j<size; j++)
+		for (int i=0; i<size; i++)
+			kernel->weights[j*size + i] = separable[i]*separable[j];
+	return true;
+}
+
+void DestroyKernel(MyKernel* kernel)
+{
+	vector<float>().swap(kernel->weights);
+	kernel->width = 0;
+	kernel->height = 0;
+}
+
+// --------------------------------------------------------------------------
+// Convolution
+
+static inline int Wrap(int i, int n)
+{
+	i %= n;
+	return i < 0 ? i + n : i;
+}
+
+bool FFTConvolve(MyImage* out, const MyImage* in, const MyKernel* kernel)
+{
+	int width = in->width, height = in->height;
+	if (width <= 0 || height <= 0 || out == in || kernel->width <= 0 || kernel->height <= 0)
+		return false;
+	int rx = kernel->width/2, ry = kernel->height/2;
+
+	// the image extended by a wrapped border of the kernel radius; linear
+	// convolution of that never wraps around a transform padded past it
+	int extW = width + 2*rx, extH = height + 2*ry;
+	int padW = FastFFTSize(extW), padH = FastFFTSize(extH);
+	const FFTPlan *rowPlan = GetFFTPlan(padW);
+	const FFTPlan *columnPlan = GetFFTPlan(padH);
+
+	// R+iG, B+iA, and the kernel, as padW x padH complex grids
+	size_t cells = (size_t)padW*padH;
+	vector<Complex> rg(cells), ba(cells), k(cells);
+	ThreadPool &pool = DefaultThreadPool();
+
+	pool.ParallelFor(extH, [&](int y0, int y1) {
+		vector<Complex> scratch(padW);
+		for (int y=y0; y<y1; y++) {
+			const float *src = &in->pixels[4*Wrap(y - ry, height)*width];
+			Complex *a = &rg[(size_t)y*padW], *b = &ba[(size_t)y*padW];
+			for (int x=0; x<extW; x++) {
+				const float *t = src + 4*Wrap(x - rx, width);
+				a[x] = Complex(t[0], t[1]);
+				b[x] = Complex(t[2], t[3]);
+			}
+			FFT(rowPlan, a, false, &scratch[0]);
+			FFT(rowPlan, b, false, &scratch[0]);
+			if (y < kernel->height) {
+				Complex *c = &k[(size_t)y*padW];
+				for (int x=0; x<kernel->width; x++)
+					c[x] = kernel->weights[y*kernel->width + x];
+				FFT(rowPlan, c, false, &scratch[0]);
+			}
+		}
+	});
+
+	// down each column: forward transform, multiply, inverse transform;
+	// rows past extH and kernel->height are zero so stay zero after the
+	// row transforms
+	int blocks = (padW + COLUMN_BLOCK - 1)/COLUMN_BLOCK;
+	pool.ParallelFor(blocks, [&](int b0, int b1) {
+		vector<Complex> scratch(padH);
+		vector<Complex> a(COLUMN_BLOCK*padH), b(COLUMN_BLOCK*padH), c(COLUMN_BLOCK*padH);
+		for (int block=b0; block<b1; block++) {
+			int x0 = block*COLUMN_BLOCK;
+			int count = min(COLUMN_BLOCK, padW - x0);
+			for (int y=0; y<padH; y++) {
+				size_t i = (size_t)y*padW + x0;
+				for (int x=0; x<count; x++)
+					a[x*padH + y] = rg[i+x], b[x*padH + y] = ba[i+x], c[x*padH + y] = k[i+x];
+			}
+			for (int x=0; x<count; x++) {
+				Complex *ca = &a[x*padH], *cb = &b[x*padH], *ck = &c[x*padH];
+				FFT(columnPlan, ca, false, &scratch[0]);
+				FFT(columnPlan, cb, false, &scratch[0]);
+				FFT(columnPlan, ck, false, &scratch[0]);
+				for (int y=0; y<padH; y++)
+					ca[y] = Mul(ca[y], ck[y]), cb[y] = Mul(cb[y], ck[y]);
+				FFT(columnPlan, ca, true, &scratch[0]);
+				FFT(columnPlan, cb, true, &scratch[0]);
+			}
+			for (int y=0; y<padH; y++) {
+				size_t i = (size_t)y*padW + x0;
+				for (int x=0; x<count; x++)
+					rg[i+x] = a[x*padH + y], ba[i+x] = b[x*padH + y];
+			}
+		}
+	});
+
+	// inverse along the rows that hold output, which start 2*radius in
+	InitializeImage(out, width, height);
+	float scale = 1.0f/((float)padW*padH);
+	pool.ParallelFor(height, [&](int y0, int y1) {
+		vector<Complex> scratch(padW);
+		for (int y=y0; y<y1; y++) {
+			Complex *a = &rg[(size_t)(y + 2*ry)*padW], *b = &ba[(size_t)(y + 2*ry)*padW];
+			FFT(rowPlan, a, true, &scratch[0]);
+			FFT(rowPlan, b, true, &scratch[0]);
+			float *o = &out->pixels[4*y*width];
+			for (int x=0; x<width; x++) {
+				o[4*x + 0] = a[x + 2*rx].real()*scale;
+				o[4*x + 1] = a[x + 2*rx].imag()*scale;
+				o[4*x + 2] = b[x + 2*rx].real()*scale;
+				o[4*x + 3] = b[x + 2*rx].imag()*scale;
+			}
+		}
+	});
+	return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "filter.h"
+#include <complex>
+
+// --------------------------------------------------------------------------
+// FFT convolution for kernels of any size, O(N log N) regardless of radius
+
+// mixed-radix transform of one length, built once and shared between calls
+struct FFTPlan
+{
+	int n;
+	std::vector<int> factors;		// (radix, remaining length) pairs
+	std::vector<std::complex<float> > twiddles;
+};
+
+// smallest length >= n with no prime factors above 5
+int FastFFTSize(int n);
+// cached plan for length n; safe to call from several threads
+const FFTPlan* GetFFTPlan(int n);
+// in-place transform of plan->n contiguous samples; scratch must
+// hold plan->n values; the inverse is unscaled
+void FFT(const FFTPlan* plan, std::complex<float>* data, bool inverse, std::complex<float>* scratch);
+
+// odd-sized convolution kernel, weights row by row, centred on the middle
+struct MyKernel
+{
+	std::vector<float> weights;
+	int width;
+	int height;
+
+	// initialize to an empty kernel
+	MyKernel();
+};
+
+bool InitializeKernel(MyKernel* kernel, int width, int height);
+// outer product of a 1D kernel with itself, as used by modes 2 and 3
+bool InitializeKernel(MyKernel* kernel, const std::vector<float>& separable);
+void DestroyKernel(MyKernel* kernel);
+
+// out(x,y) = sum kernel(i,j) in(x-i, y-j) with GL_REPEAT edges, computed
+// through transforms padded to fast sizes; pairs of RGBA channels share one
+// complex transform since both image and kernel are real
+bool FFTConvolve(MyImage* out, const MyImage* in, const MyKernel* kernel);
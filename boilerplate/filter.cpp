@@ -0,0 +1,293 @@
+#include "filter.h"
+#include "gaussian.h"
+#include "scheduler.h"
+#include <stb/stb_image.h>
+#include <iostream>
+#include <math.h>
+#include <mutex>
+
+using namespace std;
+
+// same constants the fragment shader's gaussian1D used
+static const float e = 2.71828182845904523536028747135266249775724709369995957f;
+static const float pi = 3.141592653589793238462643383279502884197169f;
+
+MyImage::MyImage() : width(0), height(0)
+	{}
+
+bool InitializeImage(MyImage* image, const char* filename)
+{
+	int numComponents;
+	// stb_image's flip setting is a global; set it once rather than from
+	// every thread loading images
+	static once_flag flipOnce;
+	call_once(flipOnce, [] { stbi_set_flip_vertically_on_load(true); });
+	unsigned char *data = stbi_load(filename, &image->width, &image->height, &numComponents, 0);
+	if (data == 0) {
+		cout << "Failed to load image: " << filename << endl;
+		return false;
+	}
+
+	// missing channels read back as zero, and alpha as one, like GL_RED/RG/RGB
+	int count = image->width*image->height;
+	image->pixels.assign(4*count, 0.0f);
+	for (int i=0; i<count; i++) {
+		float *p = &image->pixels[4*i];
+		const unsigned char *d = data + numComponents*i;
+		for (int c=0; c<numComponents && c<3; c++)
+			p[c] = d[c]/255.0f;
+		p[3] = (numComponents == 4) ? d[3]/255.0f : 1.0f;
+	}
+	stbi_image_free(data);
+	return true;
+}
+
+bool InitializeImage(MyImage* image, int width, int height)
+{
+	if (width <= 0 || height <= 0)
+		return false;
+	image->width = width;
+	image->height = height;
+	image->pixels.assign(4*width*height, 0.0f);
+	return true;
+}
+
+void DestroyImage(MyImage *image)
+{
+	vector<float>().swap(image->pixels);
+	image->width = 0;
+	image->height = 0;
+}
+
+static inline float Saturate(float x)
+{
+	return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+}
+
+void ImageBytes(const MyImage* image, unsigned char* bytes)
+{
+	for (size_t i=0; i<image->pixels.size(); i++)
+		bytes[i] = (unsigned char)(Saturate(image->pixels[i])*255.0f + 0.5f);
+}
+
+void QuantizeImage(MyImage* image, bool dropAlpha)
+{
+	for (size_t i=0; i<image->pixels.size(); i++) {
+		if (dropAlpha && i%4 == 3)
+			image->pixels[i] = 1.0f;
+		else
+			image->pixels[i] = floorf(Saturate(image->pixels[i])*255.0f + 0.5f)/255.0f;
+	}
+}
+
+// --------------------------------------------------------------------------
+// Kernels
+
+float FilterSigma(int filt)
+{
+	return .15f+0.45f*filt;
+}
+
+float Gaussian1D(float sigma, float x)
+{
+	float exponent = (x*x)/(2*sigma*sigma);
+	return 1/(powf(e,exponent)*sqrtf(2*pi*sigma*sigma));
+}
+
+// --------------------------------------------------------------------------
+// Sampling helpers
+
+// GL_REPEAT wrapping of a texel index
+static inline int Wrap(int i, int n)
+{
+	i %= n;
+	return i < 0 ? i + n : i;
+}
+
+static inline const float* Texel(const MyImage* image, int x, int y)
+{
+	return &image->pixels[4*(Wrap(y, image->height)*image->width + Wrap(x, image->width))];
+}
+
+// GL_LINEAR + GL_REPEAT lookup at normalized coordinates, for textures
+// sampled at a resolution other than their own (the border overlay)
+static void SampleLinear(const MyImage* image, float u, float v, float* out)
+{
+	float x = u*image->width - 0.5f;
+	float y = v*image->height - 0.5f;
+	int x0 = (int)floorf(x);
+	int y0 = (int)floorf(y);
+	float fx = x - x0;
+	float fy = y - y0;
+	const float *a = Texel(image, x0, y0);
+	const float *b = Texel(image, x0+1, y0);
+	const float *c = Texel(image, x0, y0+1);
+	const float *d = Texel(image, x0+1, y0+1);
+	for (int k=0; k<4; k++)
+		out[k] = (a[k]*(1-fx) + b[k]*fx)*(1-fy) + (c[k]*(1-fx) + d[k]*fx)*fy;
+}
+
+// --------------------------------------------------------------------------
+// Filters, one per mode of the fragment shader
+
+static void Greyscale(MyImage* out, const MyImage* in, int filt, const MyImage* border)
+{
+	RunTiles(in->width, in->height, [&](const MyTile& tile) {
+		for (int y=tile.y0; y<tile.y1; y++) {
+			for (int x=tile.x0; x<tile.x1; x++) {
+				const float *t = &in->pixels[4*(y*in->width + x)];
+				float *o = &out->pixels[4*(y*in->width + x)];
+				float grey;
+				if (filt == 1)
+					grey = t[0]/3.0f + t[1]/3.0f + t[2]/3.0f;
+				else if (filt == 2)
+					grey = t[0]*.299f + t[1]*.587f + t[2]*.114f;
+				else if (filt == 3)
+					grey = t[0]*.213f + t[1]*.715f + t[2]*.072f;
+				else if (filt == 4) {
+					for (int k=0; k<4; k++) o[k] = 1.0f - t[k];
+					continue;
+				}
+				else if (filt == 5 && border) {
+					float b[4];
+					SampleLinear(border, (x+0.5f)/in->width, (y+0.5f)/in->height, b);
+					if (b[0] + b[1] + b[2] == 0)
+						for (int k=0; k<4; k++) o[k] = 1.0f - t[k];
+					else
+						for (int k=0; k<4; k++) o[k] = b[k];
+					continue;
+				}
+				else {
+					for (int k=0; k<4; k++) o[k] = t[k];
+					continue;
+				}
+				for (int k=0; k<4; k++) o[k] = grey;
+			}
+		}
+	});
+}
+
+// 3x3 stencils of mode 1: horizontal Sobel, vertical Sobel, sharpen
+static void Edges(MyImage* out, const MyImage* in, int filt)
+{
+	static const float kernels[3][3][3] = {
+		{ { -1, 0, 1 }, { -2, 0, 2 }, { -1, 0, 1 } },
+		{ { -1, -2, -1 }, { 0, 0, 0 }, { 1, 2, 1 } },
+		{ { 0, -1, 0 }, { -1, 5, -1 }, { 0, -1, 0 } }
+	};
+	const float (*kernel)[3] = kernels[filt-1];
+	RunTiles(in->width, in->height, [&](const MyTile& tile) {
+		vector<float> buffer;
+		GatherTile(in, tile, 1, &buffer);
+		int stride = 4*(tile.x1 - tile.x0 + 2);
+		for (int y=tile.y0; y<tile.y1; y++) {
+			for (int x=tile.x0; x<tile.x1; x++) {
+				float sum[4] = { 0, 0, 0, 0 };
+				// texel (x, y) is at the buffer's (x-x0+1, y-y0+1), and
+				// kernel[j][i] weights the texel at (x+i-1, y+j-1)
+				const float *corner = &buffer[(y - tile.y0)*stride + 4*(x - tile.x0)];
+				for (int j=0; j<3; j++) {
+					for (int i=0; i<3; i++) {
+						if (kernel[j][i] == 0) continue;
+						const float *t = corner + j*stride + 4*i;
+						for (int k=0; k<4; k++) sum[k] += kernel[j][i]*t[k];
+					}
+				}
+				float *o = &out->pixels[4*(y*in->width + x)];
+				for (int k=0; k<4; k++) o[k] = sum[k];
+			}
+		}
+	});
+}
+
+// mode 2: direct 2D Gaussian over a gSize x gSize window, with the
+// normalized separable weights the shader uses
+static void Gaussian2DFilter(MyImage* out, const MyImage* in, float sigma, int bound)
+{
+	int size = 2*bound+1;
+	vector<float> kernel = GaussianKernel(sigma, bound);
+	vector<float> weights(size*size);
+	for (int j=0; j<size; j++)
+		for (int i=0; i<size; i++)
+			weights[j*size + i] = kernel[i]*kernel[j];
+
+	RunTiles(in->width, in->height, [&](const MyTile& tile) {
+		vector<float> buffer;
+		GatherTile(in, tile, bound, &buffer);
+		int stride = 4*(tile.x1 - tile.x0 + 2*bound);
+		for (int y=tile.y0; y<tile.y1; y++) {
+			for (int x=tile.x0; x<tile.x1; x++) {
+				float sum[4] = { 0, 0, 0, 0 };
+				const float *centre = &buffer[(y - tile.y0 + bound)*stride + 4*(x - tile.x0 + bound)];
+				for (int j=-bound; j<=bound; j++) {
+					for (int i=-bound; i<=bound; i++) {
+						float w = weights[(j+bound)*size + i+bound];
+						const float *t = centre - j*stride - 4*i;
+						for (int k=0; k<4; k++) sum[k] += w*t[k];
+					}
+				}
+				float *o = &out->pixels[4*(y*in->width + x)];
+				for (int k=0; k<4; k++) o[k] = sum[k];
+			}
+		}
+	});
+}
+
+// mode 4: the quad's interpolated vertex colours, optionally greyscaled
+static void VertexColours(MyImage* out, int filt)
+{
+	RunTiles(out->width, out->height, [&](const MyTile& tile) {
+		for (int y=tile.y0; y<tile.y1; y++) {
+			float v = (y+0.5f)/out->height;
+			for (int x=tile.x0; x<tile.x1; x++) {
+				float u = (x+0.5f)/out->width;
+				// red at (0,0), green at (1,1), blue at (0,1), black at (1,0)
+				float c[3];
+				if (v >= u)
+					c[0] = 1-v, c[1] = u, c[2] = v-u;
+				else
+					c[0] = 1-u, c[1] = v, c[2] = 0;
+				float *o = &out->pixels[4*(y*out->width + x)];
+				float grey;
+				if (filt == 1)
+					grey = c[0]*.299f + c[1]*.587f + c[2]*.114f;
+				else if (filt == 2)
+					grey = c[0]/3.0f + c[1]/3.0f + c[2]/3.0f;
+				else if (filt == 3)
+					grey = c[0]*.213f + c[1]*.715f + c[2]*.072f;
+				else {
+					o[0] = c[0], o[1] = c[1], o[2] = c[2], o[3] = 0;
+					continue;
+				}
+				for (int k=0; k<4; k++) o[k] = grey;
+			}
+		}
+	});
+}
+
+bool FilterImage(MyImage* out, const MyImage* in, int mode, int filt, int gSize,
+	const MyImage* border, GaussianMethod method)
+{
+	if (in->width <= 0 || in->height <= 0 || out == in)
+		return false;
+	InitializeImage(out, in->width, in->height);
+
+	int bound = (gSize-1)/2;
+	if (mode == 0)
+		Greyscale(out, in, filt, border);
+	else if (mode == 1 && filt >= 1 && filt <= 3)
+		Edges(out, in, filt);
+	else if (mode == 2 && filt != 0 && method == GAUSSIAN_DIRECT)
+		Gaussian2DFilter(out, in, FilterSigma(filt), bound);
+	else if (mode == 2 && filt != 0)
+		GaussianBlur(out, in, FilterSigma(filt), bound, method);
+	else if (mode == 3 && filt != 0) {
+		// the first pass goes through an 8-bit RGB render target
+		GaussianBlur(out, in, FilterSigma(filt), bound, method, true);
+	}
+	else if (mode == 4)
+		VertexColours(out, filt);
+	else
+		out->pixels = in->pixels;
+	return true;
+}
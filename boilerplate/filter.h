@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+
+// --------------------------------------------------------------------------
+// CPU versions of the filters in shaders/fragment.glsl, for running without
+// an OpenGL context
+
+struct MyImage
+{
+	// RGBA floats in [0,1], rows stored bottom-up like a flipped stbi_load
+	std::vector<float> pixels;
+	int width;
+	int height;
+
+	// initialize to an empty image
+	MyImage();
+};
+
+// decode an image file, expanding it to RGBA the same way GL samples it
+bool InitializeImage(MyImage* image, const char* filename);
+// allocate a black width x height image
+bool InitializeImage(MyImage* image, int width, int height);
+// deallocate image pixels
+void DestroyImage(MyImage *image);
+
+// clamp and round to 8 bits per channel, as writing to the framebuffer does
+void ImageBytes(const MyImage* image, unsigned char* bytes);
+// same as above, written back into the float pixels (and alpha set to one
+// when dropAlpha is set, as an RGB render target would)
+void QuantizeImage(MyImage* image, bool dropAlpha = false);
+
+// Gaussian of modes 2 and 3, before normalization (see GaussianKernel)
+float FilterSigma(int filt);
+float Gaussian1D(float sigma, float x);
+
+// how the Gaussian of modes 2 and 3 is evaluated
+enum GaussianMethod
+{
+	GAUSSIAN_DIRECT,		// the shader's gaussian1D/gaussian2D taps
+	GAUSSIAN_RECURSIVE,		// Young-van Vliet IIR, cost independent of sigma
+	GAUSSIAN_BOX,			// three box passes over a summed-area table
+	GAUSSIAN_FFT			// the direct kernel, applied through FFTs
+};
+
+// run the fragment shader's mode/filt combination over the whole image;
+// border is only needed for mode 0, filt 5
+bool FilterImage(MyImage* out, const MyImage* in, int mode, int filt, int gSize,
+	const MyImage* border = 0, GaussianMethod method = GAUSSIAN_DIRECT);
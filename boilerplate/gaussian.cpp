@@ -0,0 +1,265 @@
+#include "gaussian.h"
+#include "fft.h"
+#include "integral.h"
+#include "scheduler.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+
+// floats per vertical pass strip (16 RGBA pixels), and rows per block, so
+// one block's taps stay in cache even at 257 taps
+static const int STRIP = 64;
+static const int ROW_BLOCK = 32;
+
+static inline int Wrap(int i, int n)
+{
+	i %= n;
+	return i < 0 ? i + n : i;
+}
+
+vector<float> GaussianKernel(float sigma, int bound)
+{
+	vector<float> weights(2*bound+1);
+	float sum = 0;
+	for (int i=-bound; i<=bound; i++)
+		sum += weights[i+bound] = Gaussian1D(sigma, (float)i);
+	for (int i=0; i<=2*bound; i++)
+		weights[i] /= sum;
+	return weights;
+}
+
+void LinearSamplingKernel(const vector<float>& kernel, int bound,
+	vector<float>* offsets, vector<float>* weights)
+{
+	const float *w = &kernel[bound];
+	offsets->assign(1, 0.0f);
+	weights->assign(1, w[0]);
+	for (int i=1; i<=bound; i+=2) {
+		// a lone last tap is fetched at its texel centre
+		float pair = (i < bound) ? w[i+1] : 0.0f;
+		offsets->push_back((i*w[i] + (i+1)*pair)/(w[i] + pair));
+		weights->push_back(w[i] + pair);
+	}
+}
+
+// out(x) = sum w(i) in(x-i), using w(i) == w(-i) to halve the multiplies
+static void HorizontalPass(MyImage* out, const MyImage* in, const vector<float>& weights, int bound)
+{
+	int width = in->width;
+	const float *w = &weights[bound];
+	DefaultThreadPool().ParallelFor(in->height, [&](int y0, int y1) {
+		// one wrapped copy of the row per thread, padded by bound each side
+		vector<float> line(4*(width + 2*bound));
+		for (int y=y0; y<y1; y++) {
+			const float *row = &in->pixels[4*y*width];
+			for (int x=-bound; x<width+bound; x++)
+				copy(row + 4*Wrap(x, width), row + 4*Wrap(x, width) + 4, &line[4*(x+bound)]);
+
+			float *o = &out->pixels[4*y*width];
+			for (int x=0; x<width; x++) {
+				const float *c = &line[4*(x+bound)];
+				float sum[4] = { w[0]*c[0], w[0]*c[1], w[0]*c[2], w[0]*c[3] };
+				for (int i=1; i<=bound; i++)
+					for (int k=0; k<4; k++)
+						sum[k] += w[i]*(c[k - 4*i] + c[k + 4*i]);
+				for (int k=0; k<4; k++) o[4*x + k] = sum[k];
+			}
+		}
+	});
+}
+
+// same over columns, in tiles STRIP floats wide and ROW_BLOCK rows tall so
+// the inner loop runs along contiguous memory
+static void VerticalPass(MyImage* out, const MyImage* in, const vector<float>& weights, int bound)
+{
+	int width = in->width, height = in->height;
+	int stride = 4*width;
+	const float *w = &weights[bound];
+	RunTiles(width, height, [&](const MyTile& tile) {
+		int s0 = 4*tile.x0, s1 = 4*tile.x1;
+		for (int y=tile.y0; y<tile.y1; y++) {
+			float acc[STRIP];
+			const float *c = &in->pixels[y*stride];
+			for (int k=s0; k<s1; k++)
+				acc[k-s0] = w[0]*c[k];
+			for (int i=1; i<=bound; i++) {
+				const float *a = &in->pixels[Wrap(y-i, height)*stride];
+				const float *b = &in->pixels[Wrap(y+i, height)*stride];
+				for (int k=s0; k<s1; k++)
+					acc[k-s0] += w[i]*(a[k] + b[k]);
+			}
+			copy(acc, acc + (s1-s0), &out->pixels[y*stride + s0]);
+		}
+	}, STRIP/4, ROW_BLOCK);
+}
+
+bool SeparableGaussian(MyImage* out, const MyImage* in, float sigma, int bound,
+	bool rgbIntermediate)
+{
+	if (in->width <= 0 || in->height <= 0 || out == in || bound < 0)
+		return false;
+	vector<float> weights = GaussianKernel(sigma, bound);
+
+	MyImage temp;
+	InitializeImage(&temp, in->width, in->height);
+	HorizontalPass(&temp, in, weights, bound);
+	if (rgbIntermediate)
+		QuantizeImage(&temp, true);
+
+	InitializeImage(out, in->width, in->height);
+	VerticalPass(out, &temp, weights, bound);
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Recursive Gaussian (I.T. Young, L.J. van Vliet, "Recursive implementation
+// of the Gaussian filter", Signal Processing 44, 1995)
+
+struct RecursiveCoefficients
+{
+	float B, b1, b2, b3;	// b1..b3 already divided by b0
+	int pad;				// wrapped samples run in before each line
+};
+
+static RecursiveCoefficients RecursiveSetup(float sigma)
+{
+	float q;
+	if (sigma >= 2.5f)
+		q = 0.98711f*sigma - 0.96330f;
+	else
+		q = 3.97156f - 4.14554f*sqrtf(1.0f - 0.26891f*max(sigma, 0.5f));
+	float q2 = q*q, q3 = q2*q;
+	float b0 = 1.57825f + 2.44413f*q + 1.4281f*q2 + 0.422205f*q3;
+
+	RecursiveCoefficients c;
+	c.b1 = (2.44413f*q + 2.85619f*q2 + 1.26661f*q3)/b0;
+	c.b2 = -(1.4281f*q2 + 1.26661f*q3)/b0;
+	c.b3 = 0.422205f*q3/b0;
+	c.B = 1.0f - (c.b1 + c.b2 + c.b3);
+	// enough run-in for the start-up transient to die out
+	c.pad = (int)ceilf(4.0f*sigma) + 3;
+	return c;
+}
+
+// causal then anti-causal pass, in place, over n samples of lanes floats
+static void Recurse(float* data, int n, int lanes, const RecursiveCoefficients& c)
+{
+	// start both directions from the steady state of the edge sample
+	for (int i=1; i<n; i++) {
+		float *x = data + i*lanes;
+		const float *w1 = x - lanes;
+		const float *w2 = i >= 2 ? x - 2*lanes : data;
+		const float *w3 = i >= 3 ? x - 3*lanes : data;
+		for (int k=0; k<lanes; k++)
+			x[k] = c.B*x[k] + c.b1*w1[k] + c.b2*w2[k] + c.b3*w3[k];
+	}
+	float *last = data + (n-1)*lanes;
+	for (int i=n-2; i>=0; i--) {
+		float *x = data + i*lanes;
+		const float *y1 = x + lanes;
+		const float *y2 = i <= n-3 ? x + 2*lanes : last;
+		const float *y3 = i <= n-4 ? x + 3*lanes : last;
+		for (int k=0; k<lanes; k++)
+			x[k] = c.B*x[k] + c.b1*y1[k] + c.b2*y2[k] + c.b3*y3[k];
+	}
+}
+
+static void RecursiveRows(MyImage* out, const MyImage* in, const RecursiveCoefficients& c)
+{
+	int width = in->width;
+	DefaultThreadPool().ParallelFor(in->height, [&](int y0, int y1) {
+		vector<float> line(4*(width + 2*c.pad));
+		for (int y=y0; y<y1; y++) {
+			const float *row = &in->pixels[4*y*width];
+			for (int x=-c.pad; x<width+c.pad; x++)
+				copy(row + 4*Wrap(x, width), row + 4*Wrap(x, width) + 4, &line[4*(x+c.pad)]);
+			Recurse(&line[0], width + 2*c.pad, 4, c);
+			copy(&line[4*c.pad], &line[4*(c.pad + width)], &out->pixels[4*y*width]);
+		}
+	});
+}
+
+static void RecursiveColumns(MyImage* out, const MyImage* in, const RecursiveCoefficients& c)
+{
+	int height = in->height;
+	int stride = 4*in->width;
+	int strips = (stride + STRIP - 1)/STRIP;
+	DefaultThreadPool().ParallelFor(strips, [&](int t0, int t1) {
+		vector<float> column(STRIP*(height + 2*c.pad));
+		for (int t=t0; t<t1; t++) {
+			int s0 = t*STRIP;
+			int lanes = min(STRIP, stride - s0);
+			for (int y=-c.pad; y<height+c.pad; y++) {
+				const float *src = &in->pixels[Wrap(y, height)*stride + s0];
+				copy(src, src + lanes, &column[lanes*(y+c.pad)]);
+			}
+			Recurse(&column[0], height + 2*c.pad, lanes, c);
+			for (int y=0; y<height; y++)
+				copy(&column[lanes*(y+c.pad)], &column[lanes*(y+c.pad+1)],
+					&out->pixels[y*stride + s0]);
+		}
+	});
+}
+
+bool RecursiveGaussian(MyImage* out, const MyImage* in, float sigma, bool rgbIntermediate)
+{
+	if (in->width <= 0 || in->height <= 0 || out == in)
+		return false;
+	RecursiveCoefficients c = RecursiveSetup(sigma);
+
+	MyImage temp;
+	InitializeImage(&temp, in->width, in->height);
+	RecursiveRows(&temp, in, c);
+	if (rgbIntermediate)
+		QuantizeImage(&temp, true);
+
+	InitializeImage(out, in->width, in->height);
+	RecursiveColumns(out, &temp, c);
+	return true;
+}
+
+bool GaussianBlur(MyImage* out, const MyImage* in, float sigma, int bound,
+	GaussianMethod method, bool rgbIntermediate)
+{
+	if (method == GAUSSIAN_RECURSIVE)
+		return RecursiveGaussian(out, in, sigma, rgbIntermediate);
+	if (method == GAUSSIAN_BOX)
+		return BoxGaussian(out, in, sigma);
+	if (method == GAUSSIAN_FFT) {
+		MyKernel kernel;
+		return InitializeKernel(&kernel, GaussianKernel(sigma, bound)) &&
+			FFTConvolve(out, in, &kernel);
+	}
+	return SeparableGaussian(out, in, sigma, bound, rgbIntermediate);
+}
+
+GaussianAccuracy::GaussianAccuracy() : coverage(0), maxError(0), rmsError(0), psnr(0)
+	{}
+
+GaussianAccuracy MeasureGaussianAccuracy(const MyImage* in, float sigma, int bound,
+	GaussianMethod method)
+{
+	GaussianAccuracy accuracy;
+	for (int i=-bound; i<=bound; i++)
+		accuracy.coverage += Gaussian1D(sigma, (float)i);
+
+	MyImage reference, test;
+	if (!SeparableGaussian(&reference, in, sigma, bound) ||
+		!GaussianBlur(&test, in, sigma, bound, method))
+		return accuracy;
+
+	double squared = 0;
+	size_t samples = 0;
+	for (size_t i=0; i<reference.pixels.size(); i++) {
+		if (i%4 == 3) continue;
+		float error = fabsf(test.pixels[i] - reference.pixels[i])*255.0f;
+		accuracy.maxError = max(accuracy.maxError, error);
+		squared += error*error;
+		samples++;
+	}
+	accuracy.rmsError = (float)sqrt(squared/samples);
+	accuracy.psnr = accuracy.rmsError > 0 ? 20.0f*log10f(255.0f/accuracy.rmsError) : INFINITY;
+	return accuracy;
+}
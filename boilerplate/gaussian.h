@@ -0,0 +1,50 @@
+#pragma once
+#include "filter.h"
+
+// --------------------------------------------------------------------------
+// Multithreaded separable and recursive Gaussians, the CPU counterparts of
+// modes 2 and 3
+
+// largest kernel radius the shader's weights[] uniform holds (gSize 257)
+#define GAUSSIAN_MAX_RADIUS 128
+
+// gaussian1D(sigma, i) for i in [-bound, bound], normalized to sum to one;
+// the shader gets the same table through its weights[] uniform
+std::vector<float> GaussianKernel(float sigma, int bound);
+
+// merges taps i, i+1 (i odd) of a normalized kernel into one bilinear
+// fetch each: offsets[0] = 0 is the centre tap, and each later entry is
+// fetched at +-offset with its pair's combined weight
+void LinearSamplingKernel(const std::vector<float>& kernel, int bound,
+	std::vector<float>* offsets, std::vector<float>* weights);
+
+// horizontal pass split over rows, then vertical pass split over column
+// strips; rgbIntermediate quantizes the first pass like mode 3's RGB8 target
+bool SeparableGaussian(MyImage* out, const MyImage* in, float sigma, int bound,
+	bool rgbIntermediate = false);
+
+// Young-van Vliet recursive Gaussian: a third order causal + anti-causal
+// IIR pass per axis, so the per-pixel cost doesn't grow with sigma;
+// valid for sigma >= 0.5
+bool RecursiveGaussian(MyImage* out, const MyImage* in, float sigma,
+	bool rgbIntermediate = false);
+
+// dispatch on method; bound is ignored by the recursive and box filters, and
+// the box cascade and FFT have no intermediate pass to quantize
+bool GaussianBlur(MyImage* out, const MyImage* in, float sigma, int bound,
+	GaussianMethod method, bool rgbIntermediate = false);
+
+// error of a method against SeparableGaussian() with the direct kernel,
+// in 8-bit levels over the RGB channels
+struct GaussianAccuracy
+{
+	float coverage;			// share of the Gaussian inside the direct kernel
+	float maxError;
+	float rmsError;
+	float psnr;				// in dB, relative to a peak of 255
+
+	GaussianAccuracy();
+};
+
+GaussianAccuracy MeasureGaussianAccuracy(const MyImage* in, float sigma, int bound,
+	GaussianMethod method);
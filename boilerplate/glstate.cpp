@@ -0,0 +1,195 @@
+#include "glstate.h"
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// shadow bindings; ~0u is "unknown", so the next bind always goes through
+static const GLuint UNKNOWN = ~0u;
+static GLuint boundProgram = UNKNOWN;
+static GLuint boundTextures[GL_STATE_TEXTURE_UNITS] = { UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN,
+	UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN };
+static int activeUnit = -1;
+static GLuint boundVertexArray = UNKNOWN;
+static GLuint boundFramebuffer = UNKNOWN;
+
+// per program: uniform locations by name, and the last int or matrix set
+// at each
+static map<GLuint, map<string, GLint> > locations;
+static map<GLuint, map<GLint, int> > intValues;
+static map<GLuint, map<GLint, vector<float> > > matrixValues;
+
+static int issued = 0;
+static int skipped = 0;
+
+void CacheUniformLocations(GLuint program)
+{
+	map<string, GLint> &names = locations[program];
+	names.clear();
+	intValues[program].clear();
+	matrixValues[program].clear();
+	GLint count = 0, longest = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &longest);
+	string name(longest + 1, '\0');
+	for (GLint i=0; i<count; i++) {
+		GLsizei length = 0;
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(program, i, name.size(), &length, &size, &type, &name[0]);
+		string uniform(name, 0, length);
+		GLint location = glGetUniformLocation(program, uniform.c_str());
+		names[uniform] = location;
+		// arrays are listed as "name[0]"
+		if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0)
+			names[uniform.substr(0, uniform.size() - 3)] = location;
+	}
+}
+
+GLint UniformLocation(GLuint program, const char* name)
+{
+	map<string, GLint> &names = locations[program];
+	map<string, GLint>::iterator found = names.find(name);
+	if (found != names.end())
+		return found->second;
+	// a program that wasn't cached at link time, or a name it lacks
+	GLint location = glGetUniformLocation(program, name);
+	issued++;
+	names[name] = location;
+	return location;
+}
+
+void CachedUseProgram(GLuint program)
+{
+	if (program == boundProgram) {
+		skipped++;
+		return;
+	}
+	glUseProgram(program);
+	boundProgram = program;
+	issued++;
+}
+
+void CachedActiveTexture(int unit)
+{
+	if (unit == activeUnit) {
+		skipped++;
+		return;
+	}
+	glActiveTexture(GL_TEXTURE0 + unit);
+	activeUnit = unit;
+	issued++;
+}
+
+void CachedBindTexture(int unit, GLuint texture)
+{
+	if (texture == boundTextures[unit]) {
+		skipped++;
+		return;
+	}
+	CachedActiveTexture(unit);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	boundTextures[unit] = texture;
+	issued++;
+}
+
+void CachedBindVertexArray(GLuint vertexArray)
+{
+	if (vertexArray == boundVertexArray) {
+		skipped++;
+		return;
+	}
+	glBindVertexArray(vertexArray);
+	boundVertexArray = vertexArray;
+	issued++;
+}
+
+void CachedBindFramebuffer(GLuint framebuffer)
+{
+	if (framebuffer == boundFramebuffer) {
+		skipped++;
+		return;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	boundFramebuffer = framebuffer;
+	issued++;
+}
+
+void CachedUniform1i(GLuint program, const char* name, int value)
+{
+	GLint location = UniformLocation(program, name);
+	if (location < 0) {
+		skipped++;
+		return;
+	}
+	map<GLint, int> &values = intValues[program];
+	map<GLint, int>::iterator found = values.find(location);
+	if (found != values.end() && found->second == value) {
+		skipped++;
+		return;
+	}
+	glUniform1i(location, value);
+	values[location] = value;
+	issued++;
+}
+
+void CachedUniform1fv(GLuint program, const char* name, int count, const float* values)
+{
+	GLint location = UniformLocation(program, name);
+	if (location < 0) {
+		skipped++;
+		return;
+	}
+	glUniform1fv(location, count, values);
+	issued++;
+}
+
+void CachedUniformMatrix3fv(GLuint program, const char* name, const float* matrix)
+{
+	GLint location = UniformLocation(program, name);
+	if (location < 0) {
+		skipped++;
+		return;
+	}
+	vector<float> &value = matrixValues[program][location];
+	if (value.size() == 9 && equal(value.begin(), value.end(), matrix)) {
+		skipped++;
+		return;
+	}
+	glUniformMatrix3fv(location, 1, GL_FALSE, matrix);
+	value.assign(matrix, matrix + 9);
+	issued++;
+}
+
+void CountGLCalls(int calls)
+{
+	issued += calls;
+}
+
+void EndGLFrame(int* issuedCalls, int* skippedCalls)
+{
+	*issuedCalls = issued;
+	*skippedCalls = skipped;
+	issued = skipped = 0;
+}
+
+void InvalidateGLState()
+{
+	boundProgram = UNKNOWN;
+	for (int i=0; i<GL_STATE_TEXTURE_UNITS; i++)
+		boundTextures[i] = UNKNOWN;
+	activeUnit = -1;
+	boundVertexArray = UNKNOWN;
+	boundFramebuffer = UNKNOWN;
+}
+
+void ForgetProgram(GLuint program)
+{
+	locations.erase(program);
+	intValues.erase(program);
+	matrixValues.erase(program);
+	if (boundProgram == program)
+		boundProgram = UNKNOWN;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <glad/glad.h>
+
+// --------------------------------------------------------------------------
+// Shadow copy of the GL state the renderer touches: binds and integer
+// uniform uploads that would not change anything are skipped, uniform
+// locations are looked up once per program, and the calls that do reach GL
+// are counted per frame
+
+#define GL_STATE_TEXTURE_UNITS 8
+
+// queries every active uniform of a freshly linked program, so later
+// lookups never go to the driver
+void CacheUniformLocations(GLuint program);
+// location of name in program ("weights" finds "weights[0]"), -1 if inactive
+GLint UniformLocation(GLuint program, const char* name);
+
+void CachedUseProgram(GLuint program);
+void CachedBindTexture(int unit, GLuint texture);
+// makes unit the active texture unit, for code that binds textures itself
+// (creation and deletion go through unit 0, leaving the samplers' units be)
+void CachedActiveTexture(int unit);
+void CachedBindVertexArray(GLuint vertexArray);
+void CachedBindFramebuffer(GLuint framebuffer);
+// sets an int uniform of program, which must be in use, if it has one by
+// that name and it doesn't already hold value
+void CachedUniform1i(GLuint program, const char* name, int value);
+// float arrays aren't compared, only located and counted
+void CachedUniform1fv(GLuint program, const char* name, int count, const float* values);
+// sets a column-major mat3 uniform unless it already holds those values
+void CachedUniformMatrix3fv(GLuint program, const char* name, const float* matrix);
+
+// for calls made directly (draws, clears, buffer uploads)
+void CountGLCalls(int calls = 1);
+// calls issued and skipped since the last EndGLFrame, which resets both
+void EndGLFrame(int* issued, int* skipped);
+
+// forget the shadow bindings after code that binds behind the cache's back
+// (texture and framebuffer creation)
+void InvalidateGLState();
+// drop everything known about a program before deleting it
+void ForgetProgram(GLuint program);
@@ -0,0 +1,132 @@
+#include "integral.h"
+#include "scheduler.h"
+#include "threadpool.h"
+#include <math.h>
+
+using namespace std;
+
+MyIntegralImage::MyIntegralImage() : width(0), height(0)
+	{}
+
+bool InitializeIntegralImage(MyIntegralImage* table, const MyImage* image)
+{
+	int width = image->width, height = image->height;
+	if (width <= 0 || height <= 0)
+		return false;
+	table->width = width;
+	table->height = height;
+	int stride = 4*(width+1);
+	table->sums.assign((size_t)stride*(height+1), 0.0);
+
+	// running sums along each row, then down each column
+	DefaultThreadPool().ParallelFor(height, [&](int y0, int y1) {
+		for (int y=y0; y<y1; y++) {
+			const float *src = &image->pixels[4*y*width];
+			double *row = &table->sums[(size_t)(y+1)*stride];
+			for (int x=0; x<width; x++)
+				for (int k=0; k<4; k++)
+					row[4*(x+1) + k] = row[4*x + k] + src[4*x + k];
+		}
+	});
+	DefaultThreadPool().ParallelFor(stride, [&](int k0, int k1) {
+		for (int y=1; y<=height; y++) {
+			double *row = &table->sums[(size_t)y*stride];
+			const double *above = row - stride;
+			for (int k=k0; k<k1; k++)
+				row[k] += above[k];
+		}
+	}, 64);
+	return true;
+}
+
+void DestroyIntegralImage(MyIntegralImage* table)
+{
+	vector<double>().swap(table->sums);
+	table->width = 0;
+	table->height = 0;
+}
+
+static inline int FloorDiv(int a, int n)
+{
+	return a >= 0 ? a/n : -((-a + n - 1)/n);
+}
+
+// sum over [0, x) x [0, y) of the image tiled infinitely in both directions
+static void WrappedCorner(const MyIntegralImage* table, int x, int y, double* sum)
+{
+	int w = table->width, h = table->height;
+	int qx = FloorDiv(x, w), qy = FloorDiv(y, h);
+	int rx = x - qx*w, ry = y - qy*h;
+	int stride = 4*(w+1);
+	const double *all = &table->sums[(size_t)h*stride + 4*w];
+	const double *cols = &table->sums[(size_t)h*stride + 4*rx];
+	const double *rows = &table->sums[(size_t)ry*stride + 4*w];
+	const double *rest = &table->sums[(size_t)ry*stride + 4*rx];
+	for (int k=0; k<4; k++)
+		sum[k] = (double)qx*qy*all[k] + qy*cols[k] + qx*rows[k] + rest[k];
+}
+
+void RegionSum(const MyIntegralImage* table, int x0, int y0, int x1, int y1, double* sum)
+{
+	double a[4], b[4], c[4], d[4];
+	WrappedCorner(table, x1, y1, a);
+	WrappedCorner(table, x0, y1, b);
+	WrappedCorner(table, x1, y0, c);
+	WrappedCorner(table, x0, y0, d);
+	for (int k=0; k<4; k++)
+		sum[k] = a[k] - b[k] - c[k] + d[k];
+}
+
+static void BoxPass(MyImage* out, const MyIntegralImage* table, int radius)
+{
+	int width = table->width;
+	double scale = 1.0/((2.0*radius+1)*(2.0*radius+1));
+	RunTiles(width, table->height, [&](const MyTile& tile) {
+		for (int y=tile.y0; y<tile.y1; y++) {
+			for (int x=tile.x0; x<tile.x1; x++) {
+				double sum[4];
+				RegionSum(table, x-radius, y-radius, x+radius+1, y+radius+1, sum);
+				float *o = &out->pixels[4*(y*width + x)];
+				for (int k=0; k<4; k++) o[k] = (float)(sum[k]*scale);
+			}
+		}
+	});
+}
+
+bool BoxFilter(MyImage* out, const MyImage* in, int radius)
+{
+	MyIntegralImage table;
+	if (out == in || radius < 0 || !InitializeIntegralImage(&table, in))
+		return false;
+	InitializeImage(out, in->width, in->height);
+	BoxPass(out, &table, radius);
+	return true;
+}
+
+bool BoxGaussian(MyImage* out, const MyImage* in, float sigma)
+{
+	if (out == in || in->width <= 0 || in->height <= 0)
+		return false;
+
+	// box widths for n passes whose summed variance is closest to sigma^2:
+	// m passes of the odd width wl below the ideal, the rest of wl+2
+	const int n = 3;
+	float ideal = sqrtf(12.0f*sigma*sigma/n + 1.0f);
+	int wl = (int)floorf(ideal);
+	if (wl%2 == 0) wl--;
+	if (wl < 1) wl = 1;
+	int m = (int)roundf((12.0f*sigma*sigma - n*wl*wl - 4.0f*n*wl - 3.0f*n)/(-4.0f*wl - 4.0f));
+
+	MyImage temp[2];
+	const MyImage *src = in;
+	MyIntegralImage table;
+	for (int pass=0; pass<n; pass++) {
+		int radius = ((pass < m ? wl : wl + 2) - 1)/2;
+		MyImage *dst = (pass == n-1) ? out : &temp[pass%2];
+		InitializeIntegralImage(&table, src);
+		InitializeImage(dst, in->width, in->height);
+		BoxPass(dst, &table, radius);
+		src = dst;
+	}
+	return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "filter.h"
+
+// --------------------------------------------------------------------------
+// Summed-area table (integral image) over an RGBA image, for O(1) sums over
+// any rectangle
+
+struct MyIntegralImage
+{
+	// (width+1) x (height+1) running RGBA sums, first row and column zero;
+	// doubles so 2048x1536 sums keep full precision
+	std::vector<double> sums;
+	int width;
+	int height;
+
+	// initialize to an empty table
+	MyIntegralImage();
+};
+
+bool InitializeIntegralImage(MyIntegralImage* table, const MyImage* image);
+void DestroyIntegralImage(MyIntegralImage* table);
+
+// RGBA sum over texels [x0, x1) x [y0, y1); coordinates outside the image
+// wrap like GL_REPEAT, so any rectangle is still four lookups
+void RegionSum(const MyIntegralImage* table, int x0, int y0, int x1, int y1, double* sum);
+
+// mean over the (2*radius+1)^2 box around each texel
+bool BoxFilter(MyImage* out, const MyImage* in, int radius);
+// three box passes sized so their variance matches sigma^2
+bool BoxGaussian(MyImage* out, const MyImage* in, float sigma);
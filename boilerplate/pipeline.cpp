@@ -0,0 +1,89 @@
+#include "pipeline.h"
+#include "gaussian.h"
+
+using namespace std;
+
+Luminance::Luminance(int filt) : average(false)
+{
+	if (filt == 2)
+		r = .299f, g = .587f, b = .114f;
+	else if (filt == 3)
+		r = .213f, g = .715f, b = .072f;
+	else {
+		r = g = b = 1.0f/3.0f;
+		average = true;
+	}
+}
+
+Convolve3x3::Convolve3x3(const float (*k)[3])
+{
+	for (int j=0; j<3; j++)
+		for (int i=0; i<3; i++)
+			kernel[j][i] = k[j][i];
+}
+
+void Convolve3x3::operator()(const float* in, int inStride, float* out, int width, int height) const
+{
+	for (int y=0; y<height; y++) {
+		for (int x=0; x<width; x++) {
+			float sum[4] = { 0, 0, 0, 0 };
+			const float *corner = in + y*inStride + 4*x;
+			for (int j=0; j<3; j++) {
+				for (int i=0; i<3; i++) {
+					if (kernel[j][i] == 0) continue;
+					const float *t = corner + j*inStride + 4*i;
+					for (int k=0; k<4; k++) sum[k] += kernel[j][i]*t[k];
+				}
+			}
+			float *o = out + 4*(y*width + x);
+			for (int k=0; k<4; k++) o[k] = sum[k];
+		}
+	}
+}
+
+Convolve3x3 Sobel(bool horizontal)
+{
+	static const float kernels[2][3][3] = {
+		{ { -1, 0, 1 }, { -2, 0, 2 }, { -1, 0, 1 } },
+		{ { -1, -2, -1 }, { 0, 0, 0 }, { 1, 2, 1 } }
+	};
+	return Convolve3x3(kernels[horizontal ? 0 : 1]);
+}
+
+Convolve3x3 Sharpen()
+{
+	static const float kernel[3][3] = { { 0, -1, 0 }, { -1, 5, -1 }, { 0, -1, 0 } };
+	return Convolve3x3(kernel);
+}
+
+Blur::Blur(float sigma, int bound) : weights(GaussianKernel(sigma, bound)), bound(bound)
+	{}
+
+void Blur::operator()(const float* in, int inStride, float* out, int width, int height) const
+{
+	const float *w = &weights[bound];
+	// horizontal pass over every row of the region, halo rows included
+	int rows = height + 2*bound;
+	vector<float> temp(4*width*rows);
+	for (int y=0; y<rows; y++) {
+		for (int x=0; x<width; x++) {
+			const float *c = in + y*inStride + 4*(x + bound);
+			float *t = &temp[4*(y*width + x)];
+			for (int k=0; k<4; k++) t[k] = w[0]*c[k];
+			for (int i=1; i<=bound; i++)
+				for (int k=0; k<4; k++)
+					t[k] += w[i]*(c[k - 4*i] + c[k + 4*i]);
+		}
+	}
+	// then down the columns, along contiguous rows
+	int span = 4*width;
+	for (int y=0; y<height; y++) {
+		const float *c = &temp[(y + bound)*span];
+		float *o = out + y*span;
+		for (int k=0; k<span; k++) o[k] = w[0]*c[k];
+		for (int i=1; i<=bound; i++) {
+			const float *a = c - i*span, *b = c + i*span;
+			for (int k=0; k<span; k++) o[k] += w[i]*(a[k] + b[k]);
+		}
+	}
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include "filter.h"
+#include "scheduler.h"
+#include <algorithm>
+
+// --------------------------------------------------------------------------
+// Lazy CPU filter pipeline: chains like
+//
+//     Source(&in) | Luminance(2) | Blur(FilterSigma(3), 3) | Sobel(true)
+//
+// only build a tree of nodes. EvaluatePipeline then runs the whole chain
+// tile by tile in one sweep over the output: each tile pulls its region
+// plus the stencils' accumulated halo from the source and passes it
+// through every op in tile-sized buffers, so no full-size intermediate
+// image is ever written.
+
+// point ops transform one RGBA texel in place:
+//     void operator()(float* rgba) const;
+template <typename Derived>
+struct PointOp {};
+
+// stencil ops read a (width + 2r) x (height + 2r) RGBA region, rows
+// inStride floats apart, and write the width x height centre to out:
+//     int Radius() const;
+//     void operator()(const float* in, int inStride, float* out, int width, int height) const;
+template <typename Derived>
+struct StencilOp {};
+
+// leaf: texels of an image, wrapped like GL_REPEAT outside it
+struct SourceNode
+{
+	const MyImage* image;
+
+	explicit SourceNode(const MyImage* image) : image(image) {}
+	int Width() const { return image->width; }
+	int Height() const { return image->height; }
+	int Halo() const { return 0; }
+	void Evaluate(const MyTile& region, std::vector<float>* buffer) const
+		{ GatherTile(image, region, 0, buffer); }
+};
+
+template <typename Op, typename Child>
+struct PointNode
+{
+	Op op;
+	Child child;
+
+	PointNode(const Op& op, const Child& child) : op(op), child(child) {}
+	int Width() const { return child.Width(); }
+	int Height() const { return child.Height(); }
+	int Halo() const { return child.Halo(); }
+	void Evaluate(const MyTile& region, std::vector<float>* buffer) const
+	{
+		child.Evaluate(region, buffer);
+		for (size_t i=0; i<buffer->size(); i+=4)
+			op(&(*buffer)[i]);
+	}
+};
+
+template <typename Op, typename Child>
+struct StencilNode
+{
+	Op op;
+	Child child;
+
+	StencilNode(const Op& op, const Child& child) : op(op), child(child) {}
+	int Width() const { return child.Width(); }
+	int Height() const { return child.Height(); }
+	int Halo() const { return op.Radius() + child.Halo(); }
+	void Evaluate(const MyTile& region, std::vector<float>* buffer) const
+	{
+		int r = op.Radius();
+		MyTile wide = { region.x0 - r, region.y0 - r, region.x1 + r, region.y1 + r };
+		std::vector<float> in;
+		child.Evaluate(wide, &in);
+		int width = region.x1 - region.x0, height = region.y1 - region.y0;
+		buffer->resize(4*width*height);
+		op(&in[0], 4*(width + 2*r), &(*buffer)[0], width, height);
+	}
+};
+
+inline SourceNode Source(const MyImage* image)
+{
+	return SourceNode(image);
+}
+
+template <typename Child, typename Op>
+PointNode<Op, Child> operator|(const Child& child, const PointOp<Op>& op)
+{
+	return PointNode<Op, Child>(static_cast<const Op&>(op), child);
+}
+
+template <typename Child, typename Op>
+StencilNode<Op, Child> operator|(const Child& child, const StencilOp<Op>& op)
+{
+	return StencilNode<Op, Child>(static_cast<const Op&>(op), child);
+}
+
+// runs the whole chain into out, sized like its source
+template <typename Expr>
+bool EvaluatePipeline(MyImage* out, const Expr& expr)
+{
+	if (!InitializeImage(out, expr.Width(), expr.Height()))
+		return false;
+	// tiles at least eight halos across, so the recomputed borders stay
+	// a fraction of each tile's work
+	int halo = expr.Halo();
+	int tileWidth = std::max(TILE_WIDTH, 8*halo);
+	int tileHeight = std::max(TILE_HEIGHT, 8*halo);
+	int width = out->width;
+	RunTiles(out->width, out->height, [&](const MyTile& tile) {
+		std::vector<float> buffer;
+		expr.Evaluate(tile, &buffer);
+		int span = 4*(tile.x1 - tile.x0);
+		for (int y=tile.y0; y<tile.y1; y++)
+			std::copy(&buffer[(y - tile.y0)*span], &buffer[(y - tile.y0 + 1)*span],
+				&out->pixels[4*(y*width + tile.x0)]);
+	}, tileWidth, tileHeight);
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Ops, matching the shader's modes
+
+// mode 0, filt 1-3: average, Rec. 601 and Rec. 709 luminance
+struct Luminance : PointOp<Luminance>
+{
+	float r, g, b;
+	bool average;	// divide each channel by 3, exactly as Greyscale does
+
+	explicit Luminance(int filt);
+	void operator()(float* rgba) const
+	{
+		float grey = average ? rgba[0]/3.0f + rgba[1]/3.0f + rgba[2]/3.0f :
+			rgba[0]*r + rgba[1]*g + rgba[2]*b;
+		rgba[0] = rgba[1] = rgba[2] = rgba[3] = grey;
+	}
+};
+
+// mode 0, filt 4
+struct Invert : PointOp<Invert>
+{
+	void operator()(float* rgba) const
+	{
+		for (int k=0; k<4; k++) rgba[k] = 1.0f - rgba[k];
+	}
+};
+
+// 3x3 stencil; kernel[j][i] weights the texel at (x+i-1, y+j-1)
+struct Convolve3x3 : StencilOp<Convolve3x3>
+{
+	float kernel[3][3];
+
+	explicit Convolve3x3(const float (*kernel)[3]);
+	int Radius() const { return 1; }
+	void operator()(const float* in, int inStride, float* out, int width, int height) const;
+};
+
+// mode 1: horizontal (filt 1) or vertical (filt 2) Sobel, and sharpen
+Convolve3x3 Sobel(bool horizontal);
+Convolve3x3 Sharpen();
+
+// modes 2 and 3: separable Gaussian with the shader's normalized weights,
+// run as two passes inside the tile
+struct Blur : StencilOp<Blur>
+{
+	std::vector<float> weights;
+	int bound;
+
+	Blur(float sigma, int bound);
+	int Radius() const { return bound; }
+	void operator()(const float* in, int inStride, float* out, int width, int height) const;
+};
@@ -0,0 +1,204 @@
+#include "pixelcache.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+static const char MAGIC[8] = { 'P', 'I', 'X', 'C', 'A', 'C', 'H', '2' };
+
+// bytes hashed at each end of a source file, to catch a rewrite that keeps
+// its size within one timestamp tick
+#define CONTENT_SAMPLE 65536
+
+// what an entry was made from, and what follows: the source's path
+// (pathLength bytes, unterminated), then the pixels
+struct PixelCacheHeader
+{
+	char magic[8];
+	long long sourceSize;
+	long long sourceTime;
+	long long sourceNanoseconds;
+	unsigned long long contentHash;
+	unsigned long long pathHash;
+	int width;
+	int height;
+	int pathLength;
+};
+
+static atomic<bool> cacheEnabled(true);
+
+MyMappedImage::MyMappedImage() : pixels(0), width(0), height(0), mapping(0), length(0)
+	{}
+
+void SetPixelCacheEnabled(bool enabled)
+{
+	cacheEnabled = enabled;
+}
+
+bool PixelCacheEnabled()
+{
+	return cacheEnabled;
+}
+
+#define FNV_OFFSET 14695981039346656037ull
+
+// FNV-1a, to name entries after their source's path and fingerprint its
+// contents
+static unsigned long long Fnv1a(unsigned long long hash, const unsigned char* bytes, size_t length)
+{
+	for (size_t i=0; i<length; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+static unsigned long long PathHash(const char* path)
+{
+	return Fnv1a(FNV_OFFSET, (const unsigned char*)path, strlen(path));
+}
+
+// hashes the first and last CONTENT_SAMPLE bytes of a size-byte file (all
+// of it when smaller), which is where image headers and trailers change
+static bool ContentHash(const char* filename, long long size, unsigned long long* hash)
+{
+	FILE *file = fopen(filename, "rb");
+	if (!file)
+		return false;
+	vector<unsigned char> sample(CONTENT_SAMPLE);
+	size_t head = (size_t)min<long long>(size, CONTENT_SAMPLE);
+	bool read = fread(&sample[0], 1, head, file) == head;
+	*hash = Fnv1a(FNV_OFFSET, &sample[0], head);
+	if (read && size > CONTENT_SAMPLE) {
+		size_t tail = (size_t)min<long long>(size - CONTENT_SAMPLE, CONTENT_SAMPLE);
+		read = fseek(file, (long)(size - tail), SEEK_SET) == 0 &&
+			fread(&sample[0], 1, tail, file) == tail;
+		*hash = Fnv1a(*hash, &sample[0], tail);
+	}
+	fclose(file);
+	return read;
+}
+
+static string EntryName(unsigned long long hash)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.rgba", hash);
+	return string(PIXEL_CACHE_DIRECTORY) + "/" + name;
+}
+
+// the header an entry for filename should have now, without the size
+static bool ExpectedHeader(const char* filename, PixelCacheHeader* header)
+{
+	struct stat source;
+	if (stat(filename, &source) != 0)
+		return false;
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, MAGIC, sizeof(MAGIC));
+	header->sourceSize = source.st_size;
+	header->sourceTime = source.st_mtime;
+#ifdef __APPLE__
+	header->sourceNanoseconds = source.st_mtimespec.tv_nsec;
+#else
+	header->sourceNanoseconds = source.st_mtim.tv_nsec;
+#endif
+	header->pathHash = PathHash(filename);
+	header->pathLength = (int)strlen(filename);
+	return ContentHash(filename, source.st_size, &header->contentHash);
+}
+
+bool OpenCachedImage(MyMappedImage* image, const char* filename)
+{
+	PixelCacheHeader expected;
+	if (!cacheEnabled || !ExpectedHeader(filename, &expected))
+		return false;
+	int file = open(EntryName(expected.pathHash).c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+	struct stat entry;
+	if (fstat(file, &entry) != 0 || (size_t)entry.st_size < sizeof(PixelCacheHeader)) {
+		close(file);
+		return false;
+	}
+	void *mapping = mmap(0, entry.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (mapping == MAP_FAILED)
+		return false;
+
+	// stale (the source changed), another file's (a hash collision) or not
+	// what it says it is
+	const PixelCacheHeader *header = (const PixelCacheHeader*)mapping;
+	const char *path = (const char*)mapping + sizeof(PixelCacheHeader);
+	size_t pixelsAt = sizeof(PixelCacheHeader) + expected.pathLength;
+	if (memcmp(header->magic, expected.magic, sizeof(MAGIC)) != 0 ||
+		header->sourceSize != expected.sourceSize || header->sourceTime != expected.sourceTime ||
+		header->sourceNanoseconds != expected.sourceNanoseconds ||
+		header->contentHash != expected.contentHash || header->pathHash != expected.pathHash ||
+		header->pathLength != expected.pathLength || (size_t)entry.st_size < pixelsAt ||
+		memcmp(path, filename, expected.pathLength) != 0 || header->width <= 0 || header->height <= 0 ||
+		(size_t)entry.st_size != pixelsAt + 4*(size_t)header->width*header->height) {
+		munmap(mapping, entry.st_size);
+		return false;
+	}
+	image->mapping = mapping;
+	image->length = entry.st_size;
+	image->width = header->width;
+	image->height = header->height;
+	image->pixels = (const unsigned char*)mapping + pixelsAt;
+	return true;
+}
+
+void CloseCachedImage(MyMappedImage* image)
+{
+	if (image->mapping)
+		munmap(image->mapping, image->length);
+	image->mapping = 0;
+	image->pixels = 0;
+	image->length = 0;
+}
+
+bool StoreCachedImage(const char* filename, const unsigned char* pixels, int width, int height,
+	int components)
+{
+	PixelCacheHeader header;
+	if (!cacheEnabled || components < 1 || components > 4 || !ExpectedHeader(filename, &header))
+		return false;
+	header.width = width;
+	header.height = height;
+	mkdir(PIXEL_CACHE_DIRECTORY, 0755);
+
+	// written under a name of its own and renamed into place, so readers
+	// (and other writers) never see a partial entry
+	string entry = EntryName(header.pathHash);
+	ostringstream temporary;
+	temporary << entry << "." << getpid() << "." << this_thread::get_id() << ".tmp";
+	FILE *file = fopen(temporary.str().c_str(), "wb");
+	if (!file)
+		return false;
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(filename, 1, header.pathLength, file) == (size_t)header.pathLength;
+	vector<unsigned char> row(4*(size_t)width);
+	for (int y=0; y<height && written; y++) {
+		const unsigned char *in = pixels + (size_t)y*width*components;
+		for (int x=0; x<width; x++) {
+			unsigned char *out = &row[4*x];
+			for (int c=0; c<3; c++)
+				out[c] = c < components ? in[components*x + c] : 0;
+			out[3] = components == 4 ? in[components*x + 3] : 255;
+		}
+		written = fwrite(&row[0], 1, row.size(), file) == row.size();
+	}
+	written = fclose(file) == 0 && written;
+	if (!written || rename(temporary.str().c_str(), entry.c_str()) != 0) {
+		remove(temporary.str().c_str());
+		return false;
+	}
+	return true;
+}
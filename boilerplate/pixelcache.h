@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+
+// --------------------------------------------------------------------------
+// On-disk cache of decoded images, so a restart maps pixels straight from a
+// file instead of inflating PNGs or running the JPEG IDCT again: each entry
+// is a small header followed by RGBA8 rows, bottom row first as stb_image
+// gives them with flipping on. An entry is only used while its source
+// file's path, size, modification time (to the nanosecond) and a hash of
+// its first and last 64 KB match the ones it was made from.
+
+#define PIXEL_CACHE_DIRECTORY ".pixelcache"
+
+struct MyMappedImage
+{
+	const unsigned char* pixels;	// width*height RGBA texels
+	int width;
+	int height;
+	void* mapping;
+	size_t length;
+
+	// initialize to no mapping
+	MyMappedImage();
+};
+
+// turns the cache on or off (it is on by default)
+void SetPixelCacheEnabled(bool enabled);
+bool PixelCacheEnabled();
+
+// maps the entry for filename if there is a current one
+bool OpenCachedImage(MyMappedImage* image, const char* filename);
+void CloseCachedImage(MyMappedImage* image);
+
+// writes an entry for filename from freshly decoded pixels with the given
+// number of components, expanding them to RGBA the way GL samples
+// GL_RED/RG/RGB; safe to call from several threads
+bool StoreCachedImage(const char* filename, const unsigned char* pixels, int width, int height,
+	int components);
@@ -0,0 +1,132 @@
+#include "resultcache.h"
+#include "glstate.h"
+#include <iostream>
+
+using namespace std;
+
+bool CheckGLErrors(const char* errorLocation);
+
+bool operator<(const MyResultKey& a, const MyResultKey& b)
+{
+	if (a.source != b.source) return a.source < b.source;
+	if (a.mode != b.mode) return a.mode < b.mode;
+	if (a.filt != b.filt) return a.filt < b.filt;
+	if (a.gSize != b.gSize) return a.gSize < b.gSize;
+	if (a.level != b.level) return a.level < b.level;
+	return a.linear < b.linear;
+}
+
+bool operator==(const MyResultKey& a, const MyResultKey& b)
+{
+	return !(a < b) && !(b < a);
+}
+
+MyResultCache::MyResultCache() : readFramebuffer(0), budget((size_t)RESULT_CACHE_DEFAULT_MB << 20),
+	bytes(0), hits(0), misses(0), evictions(0)
+	{}
+
+// entries are RGB8 render targets, which drivers store as four bytes a
+// texel
+static size_t EntryBytes(const MyTexture& texture)
+{
+	return (size_t)texture.width*texture.height*4;
+}
+
+static void Evict(MyResultCache* cache, list<MyResultCache::Entry>::iterator entry)
+{
+	cache->bytes -= EntryBytes(entry->second);
+	DestroyTexture(&entry->second);
+	cache->index.erase(entry->first);
+	cache->entries.erase(entry);
+}
+
+// evicts from the least recently used end until extra more bytes fit
+static void MakeRoom(MyResultCache* cache, size_t extra)
+{
+	while (!cache->entries.empty() && cache->bytes + extra > cache->budget) {
+		Evict(cache, --cache->entries.end());
+		cache->evictions++;
+	}
+}
+
+void SetResultCacheBudget(MyResultCache* cache, size_t budget)
+{
+	cache->budget = budget;
+	MakeRoom(cache, 0);
+}
+
+MyTexture* FindResult(MyResultCache* cache, const MyResultKey& key)
+{
+	map<MyResultKey, list<MyResultCache::Entry>::iterator>::iterator found = cache->index.find(key);
+	if (found == cache->index.end()) {
+		cache->misses++;
+		return 0;
+	}
+	cache->hits++;
+	cache->entries.splice(cache->entries.begin(), cache->entries, found->second);
+	return &found->second->second;
+}
+
+MyTexture* StoreResult(MyResultCache* cache, const MyResultKey& key, MyTexture* result)
+{
+	MyTexture copy;
+	copy.width = result->width;
+	copy.height = result->height;
+	size_t size = EntryBytes(copy);
+	if (size > cache->budget)
+		return result;
+	map<MyResultKey, list<MyResultCache::Entry>::iterator>::iterator stale = cache->index.find(key);
+	if (stale != cache->index.end())
+		Evict(cache, stale->second);
+	MakeRoom(cache, size);
+
+	if (!InitializeFBO(&copy, GL_TEXTURE_2D, result->width, result->height)) {
+		cout << "Failed to allocate a result cache entry" << endl;
+		if (copy.textureID)
+			DestroyTexture(&copy);
+		return result;
+	}
+	// the result may be a plain texture (the compute path's), so attach it
+	// to a framebuffer of our own to read from
+	if (!cache->readFramebuffer)
+		glGenFramebuffers(1, &cache->readFramebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, cache->readFramebuffer);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, result->textureID, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, copy.fboID);
+	glBlitFramebuffer(0, 0, result->width, result->height, 0, 0, copy.width, copy.height,
+		GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	CountGLCalls(6);
+	InvalidateGLState();
+	if (CheckGLErrors("Storing a filtered result: ")) {
+		DestroyTexture(&copy);
+		return result;
+	}
+
+	cache->entries.push_front(MyResultCache::Entry(key, copy));
+	cache->index[key] = cache->entries.begin();
+	cache->bytes += size;
+	return &cache->entries.front().second;
+}
+
+void ForgetResults(MyResultCache* cache, GLuint source)
+{
+	list<MyResultCache::Entry>::iterator i = cache->entries.begin();
+	while (i != cache->entries.end()) {
+		list<MyResultCache::Entry>::iterator next = i;
+		++next;
+		if (i->first.source == source)
+			Evict(cache, i);
+		i = next;
+	}
+}
+
+void DestroyResultCache(MyResultCache* cache)
+{
+	while (!cache->entries.empty())
+		Evict(cache, cache->entries.begin());
+	if (cache->readFramebuffer)
+		glDeleteFramebuffers(1, &cache->readFramebuffer);
+	cache->readFramebuffer = 0;
+}
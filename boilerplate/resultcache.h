@@ -0,0 +1,61 @@
+#pragma once
+#include "texture.h"
+#include <cstddef>
+#include <list>
+#include <map>
+
+// --------------------------------------------------------------------------
+// Least-recently-used cache of filtered images in GPU memory, so going back
+// to an image/filter combination already seen is a texture bind rather than
+// a rerun of the filter; entries are evicted oldest first to stay within a
+// byte budget
+
+#define RESULT_CACHE_DEFAULT_MB 256
+
+// everything a filtered image depends on
+struct MyResultKey
+{
+	GLuint source;	// texture the filter read
+	int mode;
+	int filt;
+	int gSize;
+	int level;
+	bool linear;	// mode 3's bilinear tap merging
+};
+
+bool operator<(const MyResultKey& a, const MyResultKey& b);
+bool operator==(const MyResultKey& a, const MyResultKey& b);
+
+struct MyResultCache
+{
+	typedef std::pair<MyResultKey, MyTexture> Entry;
+
+	std::list<Entry> entries;	// most recently used first
+	std::map<MyResultKey, std::list<Entry>::iterator> index;
+	GLuint readFramebuffer;		// attaches results to copy them from
+	size_t budget;				// bytes
+	size_t bytes;
+	int hits;
+	int misses;
+	int evictions;
+
+	// initialize to empty, with the default budget
+	MyResultCache();
+};
+
+// sets the budget, evicting down to it
+void SetResultCacheBudget(MyResultCache* cache, size_t budget);
+
+// the cached result for key, now the most recent, or 0 (a miss)
+MyTexture* FindResult(MyResultCache* cache, const MyResultKey& key);
+
+// copies result, a freshly filtered texture, into a new entry for key and
+// returns it; returns result itself when it is larger than the budget or
+// the copy fails
+MyTexture* StoreResult(MyResultCache* cache, const MyResultKey& key, MyTexture* result);
+
+// drops every entry made from source, before it is deleted
+void ForgetResults(MyResultCache* cache, GLuint source);
+
+// deallocate every entry
+void DestroyResultCache(MyResultCache* cache);
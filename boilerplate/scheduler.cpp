@@ -0,0 +1,54 @@
+#include "scheduler.h"
+#include "threadpool.h"
+#include <algorithm>
+
+using namespace std;
+
+static inline int Wrap(int i, int n)
+{
+	i %= n;
+	return i < 0 ? i + n : i;
+}
+
+void RunTiles(int width, int height, const function<void(const MyTile&)>& body,
+	int tileWidth, int tileHeight)
+{
+	if (width <= 0 || height <= 0)
+		return;
+	tileWidth = max(1, min(tileWidth, width));
+	tileHeight = max(1, min(tileHeight, height));
+	int columns = (width + tileWidth - 1)/tileWidth;
+	int rows = (height + tileHeight - 1)/tileHeight;
+
+	// tiles in row-major order, so neighbouring chunks of the pool share
+	// rows of the source and their halos
+	DefaultThreadPool().ParallelFor(columns*rows, [&](int t0, int t1) {
+		for (int t=t0; t<t1; t++) {
+			MyTile tile;
+			tile.x0 = (t % columns)*tileWidth;
+			tile.y0 = (t / columns)*tileHeight;
+			tile.x1 = min(tile.x0 + tileWidth, width);
+			tile.y1 = min(tile.y0 + tileHeight, height);
+			body(tile);
+		}
+	});
+}
+
+void GatherTile(const MyImage* in, const MyTile& tile, int halo, vector<float>* buffer)
+{
+	int width = tile.x1 - tile.x0 + 2*halo;
+	int height = tile.y1 - tile.y0 + 2*halo;
+	buffer->resize(4*width*height);
+	for (int r=0; r<height; r++) {
+		const float *row = &in->pixels[4*Wrap(tile.y0 + r - halo, in->height)*in->width];
+		float *dst = &(*buffer)[4*r*width];
+		int x = tile.x0 - halo;
+		// runs of contiguous texels between wrap points
+		for (int c=0; c<width; ) {
+			int sx = Wrap(x + c, in->width);
+			int run = min(width - c, in->width - sx);
+			copy(row + 4*sx, row + 4*(sx + run), dst + 4*c);
+			c += run;
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "filter.h"
+#include <functional>
+
+// --------------------------------------------------------------------------
+// Tile scheduler for the CPU filters: splits an image into cache-sized
+// tiles and runs them on the shared work-stealing pool, so ragged edge
+// tiles of odd sizes (692x516) still balance across all cores
+
+// default tile: 128x32 RGBA floats, 64KB in and 64KB out, about an L2
+#define TILE_WIDTH 128
+#define TILE_HEIGHT 32
+
+// texels [x0, x1) x [y0, y1) of the output
+struct MyTile
+{
+	int x0, y0;
+	int x1, y1;
+};
+
+// calls body once per tile covering width x height, from any pool thread
+void RunTiles(int width, int height, const std::function<void(const MyTile&)>& body,
+	int tileWidth = TILE_WIDTH, int tileHeight = TILE_HEIGHT);
+
+// copies the tile plus a halo texels on every side into buffer, wrapping
+// like GL_REPEAT, so stencils read neighbours without per-tap wrapping;
+// buffer row r, column c is texel (x0 + c - halo, y0 + r - halo), and rows
+// are 4*(tile width + 2*halo) floats apart
+void GatherTile(const MyImage* in, const MyTile& tile, int halo, std::vector<float>* buffer);
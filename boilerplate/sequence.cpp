@@ -0,0 +1,456 @@
+#include "sequence.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// Bounded queue between two stages: Push blocks while it is full, Pop while
+// it is empty, and Close lets the consumer drain what is left and stop
+
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+	void Push(T&& item)
+	{
+		unique_lock<mutex> hold(lock);
+		notFull.wait(hold, [this] { return items.size() < capacity; });
+		items.push_back(move(item));
+		notEmpty.notify_one();
+	}
+
+	// false once the queue is closed and empty
+	bool Pop(T* item)
+	{
+		unique_lock<mutex> hold(lock);
+		notEmpty.wait(hold, [this] { return closed || !items.empty(); });
+		if (items.empty())
+			return false;
+		*item = move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	void Close()
+	{
+		lock_guard<mutex> hold(lock);
+		closed = true;
+		notEmpty.notify_all();
+	}
+
+private:
+	mutex lock;
+	condition_variable notFull;
+	condition_variable notEmpty;
+	deque<T> items;
+	size_t capacity;
+	bool closed;
+};
+
+struct SequenceFrame
+{
+	int index;
+	MyImage image;
+	bool valid;		// false when the filter failed, so the encoder skips it
+};
+
+// --------------------------------------------------------------------------
+// Frame sources and sinks
+
+enum SequenceFormat
+{
+	SEQUENCE_NUMBERED,
+	SEQUENCE_PPM,
+	SEQUENCE_Y4M
+};
+
+// what reading the next frame found
+enum FrameRead
+{
+	FRAME_READ,
+	FRAME_END,		// the sequence ended cleanly, at a frame boundary
+	FRAME_ERROR		// a frame was cut off, corrupt or undecodable
+};
+
+struct FrameSource
+{
+	SequenceFormat format;
+	string pattern;
+	int next;			// numbered: the next file's number
+	FILE* file;
+	int width;			// y4m: from the stream header
+	int height;
+	bool chroma420;		// y4m: 4:2:0, otherwise 4:4:4
+};
+
+struct FrameSink
+{
+	SequenceFormat format;
+	string pattern;
+	FILE* file;
+};
+
+static bool EndsWith(const string& text, const char* suffix)
+{
+	string end(suffix);
+	return text.size() >= end.size() && text.compare(text.size() - end.size(), end.size(), end) == 0;
+}
+
+// whether pattern is safe to hand snprintf an int: exactly one %d
+// conversion (with an optional width, as in %04d), and no other % but %%
+static bool NumberPattern(const string& pattern)
+{
+	int conversions = 0;
+	for (size_t i=0; i<pattern.size(); i++) {
+		if (pattern[i] != '%')
+			continue;
+		if (++i < pattern.size() && pattern[i] == '%')
+			continue;
+		while (i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9')
+			i++;
+		if (i == pattern.size() || pattern[i] != 'd')
+			return false;
+		conversions++;
+	}
+	return conversions == 1;
+}
+
+// pattern must have passed NumberPattern
+static string Numbered(const string& pattern, int index)
+{
+	vector<char> name(pattern.size() + 32);
+	snprintf(&name[0], name.size(), pattern.c_str(), index);
+	return string(&name[0]);
+}
+
+static bool FileExists(const string& name)
+{
+	FILE *file = fopen(name.c_str(), "rb");
+	if (file)
+		fclose(file);
+	return file != 0;
+}
+
+// skips whitespace and # comments, then reads an unsigned number
+static bool ReadHeaderNumber(FILE* file, int* value)
+{
+	int c = fgetc(file);
+	while (c == '#' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+		if (c == '#')
+			while (c != '\n' && c != EOF)
+				c = fgetc(file);
+		c = fgetc(file);
+	}
+	if (c < '0' || c > '9')
+		return false;
+	*value = 0;
+	while (c >= '0' && c <= '9') {
+		*value = *value*10 + (c - '0');
+		c = fgetc(file);
+	}
+	// the single whitespace byte after the number is consumed with it
+	return true;
+}
+
+// reads a Y4M stream header for the frame size and chroma layout
+static bool ReadY4MHeader(FrameSource* source)
+{
+	char header[256];
+	if (!fgets(header, sizeof(header), source->file) || string(header).compare(0, 10, "YUV4MPEG2 ") != 0)
+		return false;
+	source->width = source->height = 0;
+	source->chroma420 = true;
+	string fields(header);
+	size_t at = 0;
+	while ((at = fields.find(' ', at)) != string::npos) {
+		at++;
+		char tag = fields[at];
+		string value = fields.substr(at + 1, fields.find_first_of(" \n", at) - at - 1);
+		if (tag == 'W')
+			source->width = atoi(value.c_str());
+		else if (tag == 'H')
+			source->height = atoi(value.c_str());
+		else if (tag == 'C' && (value == "420" || value == "420jpeg" || value == "420paldv" ||
+			value == "420mpeg2"))
+			source->chroma420 = true;
+		else if (tag == 'C' && value == "444")
+			source->chroma420 = false;
+		else if (tag == 'C') {
+			cout << "Unsupported Y4M colour space C" << value << endl;
+			return false;
+		}
+	}
+	return source->width > 0 && source->height > 0;
+}
+
+static bool OpenFrameSource(FrameSource* source, const string& input)
+{
+	source->file = 0;
+	source->next = 0;
+	if (EndsWith(input, ".ppm")) {
+		source->format = SEQUENCE_PPM;
+		source->file = fopen(input.c_str(), "rb");
+		return source->file != 0;
+	}
+	if (EndsWith(input, ".y4m")) {
+		source->format = SEQUENCE_Y4M;
+		source->file = fopen(input.c_str(), "rb");
+		if (source->file && !ReadY4MHeader(source)) {
+			fclose(source->file);
+			source->file = 0;
+		}
+		return source->file != 0;
+	}
+	source->format = SEQUENCE_NUMBERED;
+	source->pattern = input;
+	if (!NumberPattern(input))
+		return false;
+	// numbering from 0 or 1
+	source->next = FileExists(Numbered(input, 0)) ? 0 : 1;
+	return FileExists(Numbered(input, source->next));
+}
+
+// 8-bit, top-down RGB rows into the engine's bottom-up RGBA floats
+static void StoreRGB(MyImage* image, int y, const unsigned char* rgb)
+{
+	float *row = &image->pixels[4*(size_t)(image->height - 1 - y)*image->width];
+	for (int x=0; x<image->width; x++) {
+		row[4*x + 0] = rgb[3*x + 0]/255.0f;
+		row[4*x + 1] = rgb[3*x + 1]/255.0f;
+		row[4*x + 2] = rgb[3*x + 2]/255.0f;
+		row[4*x + 3] = 1.0f;
+	}
+}
+
+static FrameRead ReadPPMFrame(FrameSource* source, MyImage* image)
+{
+	int c = fgetc(source->file);
+	while (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+		c = fgetc(source->file);
+	if (c == EOF)
+		return ferror(source->file) ? FRAME_ERROR : FRAME_END;
+	int width, height, maxval;
+	if (c != 'P' || fgetc(source->file) != '6' || !ReadHeaderNumber(source->file, &width) ||
+		!ReadHeaderNumber(source->file, &height) || !ReadHeaderNumber(source->file, &maxval) ||
+		maxval != 255 || !InitializeImage(image, width, height)) {
+		cout << "Unsupported or corrupt PPM frame (binary P6, maxval 255 only)" << endl;
+		return FRAME_ERROR;
+	}
+	vector<unsigned char> rgb(3*width);
+	for (int y=0; y<height; y++) {
+		if (fread(&rgb[0], 1, rgb.size(), source->file) != rgb.size()) {
+			cout << "Truncated PPM frame" << endl;
+			return FRAME_ERROR;
+		}
+		StoreRGB(image, y, &rgb[0]);
+	}
+	return FRAME_READ;
+}
+
+static inline unsigned char Clamp8(float x)
+{
+	return x < 0.0f ? 0 : (x > 255.0f ? 255 : (unsigned char)(x + 0.5f));
+}
+
+static FrameRead ReadY4MFrame(FrameSource* source, MyImage* image)
+{
+	char marker[256];
+	if (!fgets(marker, sizeof(marker), source->file))
+		return ferror(source->file) ? FRAME_ERROR : FRAME_END;
+	if (string(marker).compare(0, 5, "FRAME") != 0) {
+		cout << "Corrupt Y4M stream" << endl;
+		return FRAME_ERROR;
+	}
+	int width = source->width, height = source->height;
+	int chromaWidth = source->chroma420 ? (width + 1)/2 : width;
+	int chromaHeight = source->chroma420 ? (height + 1)/2 : height;
+	vector<unsigned char> luma((size_t)width*height), u((size_t)chromaWidth*chromaHeight), v(u.size());
+	if (fread(&luma[0], 1, luma.size(), source->file) != luma.size() ||
+		fread(&u[0], 1, u.size(), source->file) != u.size() ||
+		fread(&v[0], 1, v.size(), source->file) != v.size()) {
+		cout << "Truncated Y4M frame" << endl;
+		return FRAME_ERROR;
+	}
+
+	// BT.601, studio range, as Y4M streams are by convention
+	InitializeImage(image, width, height);
+	vector<unsigned char> rgb(3*width);
+	for (int y=0; y<height; y++) {
+		int cy = source->chroma420 ? y/2 : y;
+		for (int x=0; x<width; x++) {
+			int cx = source->chroma420 ? x/2 : x;
+			float Y = 1.164f*(luma[(size_t)y*width + x] - 16);
+			float U = u[(size_t)cy*chromaWidth + cx] - 128.0f;
+			float V = v[(size_t)cy*chromaWidth + cx] - 128.0f;
+			rgb[3*x + 0] = Clamp8(Y + 1.596f*V);
+			rgb[3*x + 1] = Clamp8(Y - 0.392f*U - 0.813f*V);
+			rgb[3*x + 2] = Clamp8(Y + 2.017f*U);
+		}
+		StoreRGB(image, y, &rgb[0]);
+	}
+	return FRAME_READ;
+}
+
+static FrameRead ReadFrame(FrameSource* source, MyImage* image)
+{
+	switch (source->format) {
+	case SEQUENCE_PPM:
+		return ReadPPMFrame(source, image);
+	case SEQUENCE_Y4M:
+		return ReadY4MFrame(source, image);
+	default: {
+		string name = Numbered(source->pattern, source->next);
+		if (!FileExists(name))
+			return FRAME_END;
+		source->next++;
+		return InitializeImage(image, name.c_str()) ? FRAME_READ : FRAME_ERROR;
+	}
+	}
+}
+
+static bool OpenFrameSink(FrameSink* sink, const string& output)
+{
+	sink->file = 0;
+	if (EndsWith(output, ".ppm")) {
+		sink->format = SEQUENCE_PPM;
+		sink->file = fopen(output.c_str(), "wb");
+		return sink->file != 0;
+	}
+	sink->format = SEQUENCE_NUMBERED;
+	sink->pattern = output;
+	return NumberPattern(output);
+}
+
+// index numbers the file, so a frame that failed leaves a gap rather than
+// shifting the ones after it
+static bool WriteFrame(FrameSink* sink, const MyImage* image, int index)
+{
+	if (sink->format == SEQUENCE_NUMBERED)
+		return WriteImagePNG(image, Numbered(sink->pattern, index));
+
+	vector<unsigned char> rgba(4*(size_t)image->width*image->height), rgb(3*image->width);
+	ImageBytes(image, &rgba[0]);
+	fprintf(sink->file, "P6\n%d %d\n255\n", image->width, image->height);
+	for (int y=image->height-1; y>=0; y--) {
+		const unsigned char *row = &rgba[4*(size_t)y*image->width];
+		for (int x=0; x<image->width; x++)
+			for (int c=0; c<3; c++)
+				rgb[3*x + c] = row[4*x + c];
+		if (fwrite(&rgb[0], 1, rgb.size(), sink->file) != rgb.size())
+			return false;
+	}
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// The pipeline
+
+typedef chrono::steady_clock Clock;
+
+static double Seconds(Clock::time_point start)
+{
+	return chrono::duration<double>(Clock::now() - start).count();
+}
+
+int RunSequence(const string& input, const MyBatchSpec& spec, const string& output)
+{
+	FrameSource source;
+	FrameSink sink;
+	if (!OpenFrameSource(&source, input)) {
+		cout << "Can't read a frame sequence from " << input << endl;
+		return -1;
+	}
+	if (!OpenFrameSink(&sink, output)) {
+		cout << "Can't write a frame sequence to " << output
+			<< " (a .ppm file, or a pattern with one %d, like out/frame_%04d.png)" << endl;
+		if (source.file)
+			fclose(source.file);
+		return -1;
+	}
+	MyImage border;
+	if (spec.mode == 0 && spec.filt == 5 && !InitializeImage(&border, "blood2.png")) {
+		if (source.file)
+			fclose(source.file);
+		if (sink.file)
+			fclose(sink.file);
+		return -1;
+	}
+
+	BoundedQueue<SequenceFrame> decoded(SEQUENCE_QUEUE_FRAMES), filtered(SEQUENCE_QUEUE_FRAMES);
+	double decodeBusy = 0, filterBusy = 0, encodeBusy = 0;
+	int frames = 0, failures = 0;
+	bool readFailed = false;
+	Clock::time_point start = Clock::now();
+
+	thread decoder([&] {
+		for (int index=0; ; index++) {
+			Clock::time_point begin = Clock::now();
+			SequenceFrame frame;
+			frame.index = index;
+			frame.valid = true;
+			FrameRead read = ReadFrame(&source, &frame.image);
+			decodeBusy += Seconds(begin);
+			// a frame that can't be read ends the sequence, but as a failure
+			if (read == FRAME_ERROR) {
+				cout << "Failed to read frame " << index << endl;
+				readFailed = true;
+			}
+			if (read != FRAME_READ)
+				break;
+			decoded.Push(move(frame));
+		}
+		decoded.Close();
+	});
+
+	thread filterer([&] {
+		SequenceFrame frame;
+		while (decoded.Pop(&frame)) {
+			Clock::time_point begin = Clock::now();
+			SequenceFrame result;
+			result.index = frame.index;
+			result.valid = FilterImage(&result.image, &frame.image, spec.mode, spec.filt, spec.gSize,
+				&border, spec.method);
+			filterBusy += Seconds(begin);
+			filtered.Push(move(result));
+		}
+		filtered.Close();
+	});
+
+	// encoding on this thread, in order
+	SequenceFrame frame;
+	while (filtered.Pop(&frame)) {
+		Clock::time_point begin = Clock::now();
+		if (!frame.valid || !WriteFrame(&sink, &frame.image, frame.index)) {
+			cout << "Failed to filter or write frame " << frame.index << endl;
+			failures++;
+		}
+		else
+			frames++;
+		encodeBusy += Seconds(begin);
+	}
+	decoder.join();
+	filterer.join();
+	if (readFailed)
+		failures++;
+	if (source.file)
+		fclose(source.file);
+	if (sink.file)
+		fclose(sink.file);
+
+	double seconds = Seconds(start);
+	cout << frames << " frames in " << seconds << " s: " << frames/seconds << " frames/sec" << endl
+		<< "busy: decode " << decodeBusy << " s, filter " << filterBusy << " s, encode "
+		<< encodeBusy << " s (" << decodeBusy + filterBusy + encodeBusy << " s if run serially)" << endl;
+	return failures;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "batch.h"
+#include <string>
+
+// --------------------------------------------------------------------------
+// Streaming a frame sequence through the CPU engine as a three-stage
+// pipeline,
+//
+//     boilerplate.out --sequence <input> <mode:filt[:gSize[:method]]> <output>
+//
+// where decoding, filtering and encoding each run on a thread of their own,
+// handing frames on through bounded queues: a stage that gets ahead blocks
+// once SEQUENCE_QUEUE_FRAMES are waiting, so memory stays bounded and the
+// frame rate is that of the slowest stage. The filter stage still splits
+// each frame over the thread pool.
+//
+// input is a printf pattern of numbered images ("in/frame_%04d.png",
+// counting from 0 or 1), a .ppm file of concatenated binary (P6) frames or
+// a .y4m stream (4:2:0 or 4:4:4, 8 bit); output is a .ppm stream, or a
+// pattern the frames are written to as numbered PNGs from 0
+
+#define SEQUENCE_QUEUE_FRAMES 4
+
+// filters input into output and prints frames/sec and each stage's busy
+// time; returns the number of frames that failed, or -1 if input, output
+// or the border image (mode 0, filt 5) couldn't be opened
+int RunSequence(const std::string& input, const MyBatchSpec& spec, const std::string& output);
@@ -1,8 +1,13 @@
 #include "texture.h"
+#include "glstate.h"
+#include <cstring>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
+#include <chrono>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
 
 using namespace std;
 
@@ -31,24 +36,94 @@ bool CheckGLErrors(const char* errorLocation)
 	return error;
 }
 
-MyTexture::MyTexture() : textureID(0), target(0), width(0), height(0)
+MyTexture::MyTexture() : textureID(0), target(0), width(0), height(0), fboID(0)
 	{}
 
 
-bool InitializeTexture(MyTexture* texture, const char* filename, GLuint target)
+MyDecodedImage::MyDecodedImage() : data(0), width(0), height(0), components(0), pixelBuffer(0),
+	fromCache(false)
+	{}
+
+// copies size bytes into destination if they fit, for image to point at
+static bool CopyToDestination(MyDecodedImage* image, const unsigned char* pixels, size_t size,
+	void* destination, size_t capacity)
+{
+	bool fits = size <= capacity;
+	if (fits)
+		memcpy(destination, pixels, size);
+	image->data = fits ? (unsigned char*)destination : 0;
+	return fits;
+}
+
+bool DecodeImage(MyDecodedImage* image, const char* filename, void* destination, size_t capacity)
 {
-	int numComponents;
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char *data = stbi_load(filename, &texture->width, &texture->height, &numComponents, 0);
-	if (data != 0)
+	// stb_image's flip setting is a global, so set it before any decode
+	// rather than from every thread
+	static once_flag flipOnce;
+	call_once(flipOnce, [] { stbi_set_flip_vertically_on_load(true); });
+
+	// a current cache entry needs no decoding at all: its pixels are used
+	// where they are mapped, or copied once into the destination
+	MyMappedImage cached;
+	if (OpenCachedImage(&cached, filename)) {
+		image->width = cached.width;
+		image->height = cached.height;
+		image->components = 4;
+		image->fromCache = true;
+		if (!destination) {
+			image->mapped = cached;
+			image->data = (unsigned char*)cached.pixels;
+			return true;
+		}
+		bool copied = CopyToDestination(image, cached.pixels, 4*(size_t)cached.width*cached.height,
+			destination, capacity);
+		CloseCachedImage(&cached);
+		return copied;
+	}
+
+	// stb reads back its own output (PNG unfiltering reads the row above,
+	// and the flip swaps rows), which a write-mapped pixel buffer can't be,
+	// so decode into client memory and copy it over in one pass
+	unsigned char *data = stbi_load(filename, &image->width, &image->height, &image->components, 0);
+	if (!data)
+		return false;
+	if (PixelCacheEnabled())
+		StoreCachedImage(filename, data, image->width, image->height, image->components);
+	if (!destination) {
+		image->data = data;
+		return true;
+	}
+	bool copied = CopyToDestination(image, data,
+		(size_t)image->width*image->height*image->components, destination, capacity);
+	stbi_image_free(data);
+	return copied;
+}
+
+void FreeImage(MyDecodedImage* image)
+{
+	// pixels in a pixel buffer belong to the buffer, and cached ones to the
+	// cache file
+	if (image->mapped.mapping)
+		CloseCachedImage(&image->mapped);
+	else if (image->data && !image->pixelBuffer)
+		stbi_image_free(image->data);
+	image->data = 0;
+}
+
+bool UploadTexture(MyTexture* texture, MyDecodedImage* image, const char* filename, GLuint target)
+{
+	if (image->data != 0)
 	{
+		texture->width = image->width;
+		texture->height = image->height;
 		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);		//Set alignment to be 1
 
 		texture->target = target;
 		glGenTextures(1, &texture->textureID);
+		CachedActiveTexture(0);
 		glBindTexture(texture->target, texture->textureID);
 		GLuint format = GL_RGB;
-		switch(numComponents)
+		switch(image->components)
 		{
 			case 4:
 				format = GL_RGBA;
@@ -66,7 +141,27 @@ bool InitializeTexture(MyTexture* texture, const char* filename, GLuint target)
 				cout << "Invalid Texture Format" << endl;
 				break;
 		};
-		glTexImage2D(texture->target, 0, format, texture->width, texture->height, 0, format, GL_UNSIGNED_BYTE, data);
+		// from a pixel buffer, the driver copies out of it asynchronously;
+		// an unmap that fails means its contents were lost
+		const void *pixels = image->data;
+		if (image->pixelBuffer) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, image->pixelBuffer);
+			if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_TRUE) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				glBindTexture(texture->target, 0);
+				glDeleteTextures(1, &texture->textureID);
+				texture->textureID = 0;
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+				image->data = 0;
+				InvalidateGLState();
+				cout << "Loading texture: " << filename << ": pixel buffer contents were lost" << endl;
+				return false;
+			}
+			pixels = 0;
+		}
+		glTexImage2D(texture->target, 0, format, texture->width, texture->height, 0, format, GL_UNSIGNED_BYTE, pixels);
+		if (image->pixelBuffer)
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
 		// Note: Only wrapping modes supported for GL_TEXTURE_RECTANGLE when defining
 		// GL_TEXTURE_WRAP are GL_CLAMP_TO_EDGE or GL_CLAMP_TO_BORDER
@@ -77,7 +172,8 @@ bool InitializeTexture(MyTexture* texture, const char* filename, GLuint target)
 		// Clean up
 		glBindTexture(texture->target, 0);
 		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);	//Return to default alignment
-		stbi_image_free(data);
+		FreeImage(image);
+		InvalidateGLState();
 
 
 
@@ -86,7 +182,209 @@ bool InitializeTexture(MyTexture* texture, const char* filename, GLuint target)
 	return true; //error
 }
 
-bool InitializeFBO(MyTexture* texture, GLuint target)
+static double Milliseconds(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+bool InitializeTexture(MyTexture* texture, const char* filename, GLuint target)
+{
+	MyDecodedImage image;
+	chrono::steady_clock::time_point decodeStart = chrono::steady_clock::now();
+	DecodeImage(&image, filename);
+	double decodeTime = Milliseconds(decodeStart);
+	chrono::steady_clock::time_point uploadStart = chrono::steady_clock::now();
+	bool success = UploadTexture(texture, &image, filename, target);
+	cout << "Loaded " << filename << ": decode " << decodeTime << " ms, upload "
+		<< Milliseconds(uploadStart) << " ms" << endl;
+	return success;
+}
+
+bool InitializeSolidTexture(MyTexture* texture, unsigned char grey)
+{
+	unsigned char texel[3] = { grey, grey, grey };
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	texture->target = GL_TEXTURE_2D;
+	texture->width = texture->height = 1;
+	glGenTextures(1, &texture->textureID);
+	CachedActiveTexture(0);
+	glBindTexture(GL_TEXTURE_2D, texture->textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, texel);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	InvalidateGLState();
+	return !CheckGLErrors("Creating placeholder texture: ");
+}
+
+MyUploadBuffers::MyUploadBuffers() : next(0)
+{
+	for (int i=0; i<UPLOAD_BUFFERS; i++) {
+		buffers[i] = 0;
+		sizes[i] = 0;
+		mapped[i] = false;
+	}
+}
+
+bool InitializeUploadBuffers(MyUploadBuffers* uploads)
+{
+	glGenBuffers(UPLOAD_BUFFERS, uploads->buffers);
+	return !CheckGLErrors("Creating upload buffers: ");
+}
+
+void* MapUploadBuffer(MyUploadBuffers* uploads, MyDecodedImage* image, size_t size)
+{
+	for (int n=0; n<UPLOAD_BUFFERS; n++) {
+		int i = (uploads->next + n) % UPLOAD_BUFFERS;
+		if (uploads->mapped[i] || !uploads->buffers[i])
+			continue;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploads->buffers[i]);
+		// a fresh store (or an invalidated one) rather than waiting for the
+		// driver to finish reading the last upload out of it
+		if (uploads->sizes[i] < size) {
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, 0, GL_STREAM_DRAW);
+			uploads->sizes[i] = size;
+		}
+		void *memory = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, uploads->sizes[i],
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		CountGLCalls(4);
+		if (!memory) {
+			CheckGLErrors("Mapping upload buffer: ");
+			return 0;
+		}
+		uploads->mapped[i] = true;
+		uploads->next = (i + 1) % UPLOAD_BUFFERS;
+		image->pixelBuffer = uploads->buffers[i];
+		return memory;
+	}
+	return 0;
+}
+
+// marks image's buffer free, unmapping it if the upload didn't
+static void ReleaseUploadBuffer(MyUploadBuffers* uploads, MyDecodedImage* image, bool unmap)
+{
+	for (int i=0; i<UPLOAD_BUFFERS; i++) {
+		if (uploads->buffers[i] != image->pixelBuffer)
+			continue;
+		if (unmap && uploads->mapped[i]) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, image->pixelBuffer);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+		uploads->mapped[i] = false;
+	}
+	image->pixelBuffer = 0;
+	image->data = 0;
+}
+
+bool UploadStreamedTexture(MyTexture* texture, MyUploadBuffers* uploads, MyDecodedImage* image,
+	const char* filename)
+{
+	bool success = UploadTexture(texture, image, filename);
+	ReleaseUploadBuffer(uploads, image, false);
+	return success;
+}
+
+void DestroyUploadBuffers(MyUploadBuffers* uploads)
+{
+	// deleting a mapped buffer unmaps it
+	glDeleteBuffers(UPLOAD_BUFFERS, uploads->buffers);
+	for (int i=0; i<UPLOAD_BUFFERS; i++) {
+		uploads->buffers[i] = 0;
+		uploads->sizes[i] = 0;
+		uploads->mapped[i] = false;
+	}
+}
+
+MyLazyTexture::MyLazyTexture() : filename(0), width(0), height(0), components(0),
+	decodeTime(0), state(LAZY_UNLOADED)
+	{}
+
+bool InitializeLazyTexture(MyLazyTexture* lazy, const char* filename)
+{
+	lazy->filename = filename;
+	if (!stbi_info(filename, &lazy->width, &lazy->height, &lazy->components)) {
+		cout << "Failed to read image header: " << filename << endl;
+		lazy->state = LAZY_FAILED;
+		return false;
+	}
+	lazy->state = LAZY_UNLOADED;
+	return true;
+}
+
+MyTexture* RequestTexture(MyLazyTexture* lazy, MyUploadBuffers* uploads)
+{
+	switch (lazy->state) {
+	case LAZY_READY:
+		return &lazy->texture;
+	case LAZY_UNLOADED: {
+		lazy->state = LAZY_DECODING;
+		// map a buffer here, on the GL thread, for the decoder to fill
+		MyDecodedImage *image = &lazy->decoded;
+		image->width = lazy->width;
+		image->height = lazy->height;
+		image->components = lazy->components;
+		// room for RGBA, which is what the pixel cache holds
+		size_t capacity = (size_t)lazy->width*lazy->height*4;
+		void *destination = uploads ? MapUploadBuffer(uploads, image, capacity) : 0;
+		lazy->decoder = thread([lazy, destination, capacity] {
+			chrono::steady_clock::time_point decodeStart = chrono::steady_clock::now();
+			bool decoded = DecodeImage(&lazy->decoded, lazy->filename, destination, capacity);
+			lazy->decodeTime = Milliseconds(decodeStart);
+			lazy->state = decoded ? LAZY_DECODED : LAZY_FAILED;
+			glfwPostEmptyEvent();
+		});
+		return 0;
+	}
+	case LAZY_DECODED: {
+		lazy->decoder.join();
+		chrono::steady_clock::time_point uploadStart = chrono::steady_clock::now();
+		bool streamed = lazy->decoded.pixelBuffer != 0;
+		bool fromCache = lazy->decoded.fromCache;
+		bool uploaded = streamed ?
+			UploadStreamedTexture(&lazy->texture, uploads, &lazy->decoded, lazy->filename) :
+			UploadTexture(&lazy->texture, &lazy->decoded, lazy->filename);
+		if (!uploaded) {
+			lazy->state = LAZY_FAILED;
+			return 0;
+		}
+		cout << "Loaded " << lazy->filename << " on first use (decode " << lazy->decodeTime
+			<< " ms, upload " << Milliseconds(uploadStart)
+			<< " ms, " << (fromCache ? "from the pixel cache, " : "") << (streamed ? "through a pixel buffer" :
+			"from client memory") << ")" << endl;
+		lazy->state = LAZY_READY;
+		return &lazy->texture;
+	}
+	case LAZY_FAILED:
+		// give back the buffer a failed decode was writing into
+		if (lazy->decoder.joinable())
+			lazy->decoder.join();
+		if (lazy->decoded.pixelBuffer && uploads)
+			ReleaseUploadBuffer(uploads, &lazy->decoded, true);
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+bool LazyTexturePending(const MyLazyTexture* lazy)
+{
+	return lazy->state == LAZY_DECODING;
+}
+
+void DestroyLazyTexture(MyLazyTexture* lazy)
+{
+	if (lazy->decoder.joinable())
+		lazy->decoder.join();
+	FreeImage(&lazy->decoded);
+	if (lazy->texture.textureID)
+		DestroyTexture(&lazy->texture);
+	lazy->state = LAZY_UNLOADED;
+}
+
+bool InitializeFBO(MyTexture* texture, GLuint target, int width, int height)
 {
 //	int numComponents;
 //	texture->textureID = fbName;
@@ -95,15 +393,18 @@ bool InitializeFBO(MyTexture* texture, GLuint target)
 	glGenTextures(1, &texture->textureID);
 
 	// "Bind" the newly created texture : all future texture functions will modify this texture
+	CachedActiveTexture(0);
 	glBindTexture(GL_TEXTURE_2D, texture->textureID);
-texture->width=480;
-texture->height=1000;
+	texture->target = GL_TEXTURE_2D;
+	texture->width = width;
+	texture->height = height;
 	// Give an empty image to OpenGL ( the last "0" )
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, 512, 512, 0,GL_RGB, GL_UNSIGNED_BYTE, 0);
+	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0,GL_RGB, GL_UNSIGNED_BYTE, 0);
 
-	// Poor filtering. Needed !
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	// Linear filtering, so the second Gaussian pass can merge taps into
+	// bilinear fetches
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	
 //	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, renderedTexture, 0);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture->textureID, 0);
@@ -111,8 +412,10 @@ texture->height=1000;
 //	glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
 //	glBindTexture(GL_TEXTURE_2D, 0);
 
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	InvalidateGLState();
+	if(status != GL_FRAMEBUFFER_COMPLETE)
 		return false;
 //		return !CheckGLErrors( (string("Loading texture: ")+filename).c_str() );
 //	}
@@ -123,7 +426,14 @@ texture->height=1000;
 // deallocate texture-related objects
 void DestroyTexture(MyTexture *texture)
 {
+	CachedActiveTexture(0);
 	glBindTexture(texture->target, 0);
 	glDeleteTextures(1, &texture->textureID);
+	InvalidateGLState();
+	texture->textureID = 0;
+	if (texture->fboID) {
+		glDeleteFramebuffers(1, &texture->fboID);
+		texture->fboID = 0;
+	}
 }
 
@@ -1,6 +1,9 @@
 #pragma once
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include "pixelcache.h"
+#include <atomic>
+#include <thread>
 
 // --------------------------------------------------------------------------
 // Functions to set up OpenGL buffers for storing textures
@@ -17,7 +20,110 @@ struct MyTexture
 	MyTexture();
 };
 
+// pixels decoded by stb_image, not yet uploaded
+struct MyDecodedImage
+{
+	unsigned char* data;
+	int width;
+	int height;
+	int components;
+	GLuint pixelBuffer;		// mapped unpack buffer data points into, or 0
+	bool fromCache;			// read from the pixel cache, not decoded
+	MyMappedImage mapped;	// the cache entry data points into, if any
+
+	// initialize to no pixels
+	MyDecodedImage();
+};
+
+// decodes filename (flipped for GL) without touching GL, so it can run on
+// any thread; returns false if the file couldn't be read. Given a
+// destination (a write-only mapped pixel buffer) of capacity bytes, the
+// pixels are decoded into client memory and copied there in one pass,
+// failing if they don't fit. Files with an
+// entry in the pixel cache are mapped from it (RGBA) instead of decoded,
+// and those without get one
+bool DecodeImage(MyDecodedImage* image, const char* filename, void* destination = 0,
+	size_t capacity = 0);
+void FreeImage(MyDecodedImage* image);
+// uploads a decoded image into a new texture and frees its pixels; an image
+// in a pixel buffer is unmapped and uploaded from it, failing if the
+// unmap reports its contents lost
+bool UploadTexture(MyTexture* texture, MyDecodedImage* image, const char* filename, GLuint target = GL_TEXTURE_2D);
+
+// decodes and uploads filename on the calling (GL) thread, printing the
+// time each took
 bool InitializeTexture(MyTexture* texture, const char* filename, GLuint target = GL_TEXTURE_2D);
-bool InitializeFBO(MyTexture* texture, GLuint target = GL_TEXTURE_2D);
-// deallocate texture-related objects
+// creates a framebuffer with an empty width x height RGB colour texture
+bool InitializeFBO(MyTexture* texture, GLuint target = GL_TEXTURE_2D, int width = 512, int height = 512);
+// deallocate texture-related objects (and the framebuffer, if any)
 void DestroyTexture(MyTexture *texture);
+
+// a 1x1 texture of one grey level, to show while an image loads
+bool InitializeSolidTexture(MyTexture* texture, unsigned char grey);
+
+// --------------------------------------------------------------------------
+// Textures loaded on first use: the file's header is read up front for its
+// size, and the pixels are decoded on a background thread the first time
+// the texture is requested, then uploaded on the GL thread
+
+#define UPLOAD_BUFFERS 2
+
+// double-buffered pixel unpack buffers: an image is copied into one while the
+// driver may still be copying the last one out of the other
+struct MyUploadBuffers
+{
+	GLuint buffers[UPLOAD_BUFFERS];
+	size_t sizes[UPLOAD_BUFFERS];
+	bool mapped[UPLOAD_BUFFERS];
+	int next;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyUploadBuffers();
+};
+
+bool InitializeUploadBuffers(MyUploadBuffers* uploads);
+// maps a buffer of at least size bytes for image's pixels to be copied
+// into, setting its pixelBuffer; returns 0 when both are in use
+void* MapUploadBuffer(MyUploadBuffers* uploads, MyDecodedImage* image, size_t size);
+// uploads image from its buffer (see UploadTexture) and frees the buffer
+// for reuse
+bool UploadStreamedTexture(MyTexture* texture, MyUploadBuffers* uploads, MyDecodedImage* image,
+	const char* filename);
+void DestroyUploadBuffers(MyUploadBuffers* uploads);
+
+enum LazyState
+{
+	LAZY_UNLOADED,
+	LAZY_DECODING,
+	LAZY_DECODED,	// waiting for the GL thread to upload
+	LAZY_READY,
+	LAZY_FAILED
+};
+
+struct MyLazyTexture
+{
+	MyTexture texture;			// valid once ready
+	const char* filename;
+	int width;					// from the header, known before decoding
+	int height;
+	int components;
+	MyDecodedImage decoded;
+	double decodeTime;			// ms, set by the decoder before its state
+	std::atomic<int> state;
+	std::thread decoder;
+
+	// initialize to no file
+	MyLazyTexture();
+};
+
+// reads filename's header; returns false if it isn't a readable image
+bool InitializeLazyTexture(MyLazyTexture* lazy, const char* filename);
+// the texture if it is ready, or 0 after starting its decode if needed;
+// uploads it here once the decode has finished, streaming it through
+// uploads when one of its buffers is free. Posts an empty GLFW event when
+// a decode finishes, so a loop in glfwWaitEvents wakes to request it
+MyTexture* RequestTexture(MyLazyTexture* lazy, MyUploadBuffers* uploads = 0);
+// whether a decode is still running
+bool LazyTexturePending(const MyLazyTexture* lazy);
+// waits for any decode, and deallocates the pixels and texture
+void DestroyLazyTexture(MyLazyTexture* lazy);
@@ -0,0 +1,132 @@
+#include "threadpool.h"
+
+using namespace std;
+
+// set on pool threads and while a caller is running chunks, so nested
+// ParallelFor calls don't wait on themselves
+static thread_local bool insidePool = false;
+
+ThreadPool::ThreadPool(int threads) : body(0), count(0), chunk(1), active(0),
+	generation(0), stopping(false)
+{
+	if (threads <= 0)
+		threads = (int)thread::hardware_concurrency();
+	if (threads < 1)
+		threads = 1;
+	for (int t=0; t<threads; t++)
+		queues.push_back(unique_ptr<WorkQueue>(new WorkQueue));
+	for (int t=0; t<threads-1; t++)
+		workers.push_back(thread(&ThreadPool::WorkerLoop, this, t));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(jobMutex);
+		stopping = true;
+	}
+	jobReady.notify_all();
+	for (size_t t=0; t<workers.size(); t++)
+		workers[t].join();
+}
+
+bool ThreadPool::NextChunk(int index, int* chunkIndex)
+{
+	{
+		WorkQueue &own = *queues[index];
+		lock_guard<mutex> lock(own.lock);
+		if (!own.chunks.empty()) {
+			*chunkIndex = own.chunks.front();
+			own.chunks.pop_front();
+			return true;
+		}
+	}
+	// steal from the far end of the others, nearest neighbour first
+	for (size_t i=1; i<queues.size(); i++) {
+		WorkQueue &other = *queues[(index + i) % queues.size()];
+		lock_guard<mutex> lock(other.lock);
+		if (!other.chunks.empty()) {
+			*chunkIndex = other.chunks.back();
+			other.chunks.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::RunChunks(int index)
+{
+	int c;
+	while (NextChunk(index, &c)) {
+		int begin = c*chunk;
+		int end = begin + chunk < count ? begin + chunk : count;
+		(*body)(begin, end);
+	}
+}
+
+void ThreadPool::WorkerLoop(int index)
+{
+	insidePool = true;
+	unsigned seen = 0;
+	for (;;) {
+		{
+			unique_lock<mutex> lock(jobMutex);
+			jobReady.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+		}
+		RunChunks(index);
+		{
+			lock_guard<mutex> lock(jobMutex);
+			if (--active == 0)
+				jobDone.notify_one();
+		}
+	}
+}
+
+void ThreadPool::ParallelFor(int count, const function<void(int, int)>& body, int grain)
+{
+	if (count <= 0)
+		return;
+	if (grain < 1) grain = 1;
+	if (insidePool || workers.empty() || count <= grain) {
+		body(0, count);
+		return;
+	}
+
+	lock_guard<mutex> call(callMutex);
+	{
+		lock_guard<mutex> lock(jobMutex);
+		this->body = &body;
+		this->count = count;
+		// a few chunks per thread so uneven work can be stolen
+		int chunks = 4*Size();
+		chunk = (count + chunks - 1)/chunks;
+		if (chunk < grain) chunk = grain;
+		chunks = (count + chunk - 1)/chunk;
+		// deal neighbouring chunks to the same thread, for locality
+		for (int t=0; t<Size(); t++) {
+			lock_guard<mutex> queueLock(queues[t]->lock);
+			for (int c=chunks*t/Size(); c<chunks*(t+1)/Size(); c++)
+				queues[t]->chunks.push_back(c);
+		}
+		active = (int)workers.size();
+		generation++;
+	}
+	jobReady.notify_all();
+
+	insidePool = true;
+	RunChunks((int)workers.size());
+	insidePool = false;
+
+	unique_lock<mutex> lock(jobMutex);
+	jobDone.wait(lock, [&] { return active == 0; });
+	this->body = 0;
+}
+
+ThreadPool& DefaultThreadPool()
+{
+	static ThreadPool pool;
+	return pool;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// --------------------------------------------------------------------------
+// Persistent worker threads with work stealing, for splitting CPU filters
+// over rows, columns or tiles
+
+class ThreadPool
+{
+public:
+	// threads <= 0 uses one thread per hardware core
+	explicit ThreadPool(int threads = 0);
+	~ThreadPool();
+
+	// number of threads taking part in a ParallelFor, including the caller
+	int Size() const { return (int)workers.size() + 1; }
+
+	// call body(begin, end) over chunks of [0, count) of at least grain
+	// items, returning once all chunks are done; runs serially when called
+	// from inside another ParallelFor
+	void ParallelFor(int count, const std::function<void(int, int)>& body, int grain = 1);
+
+private:
+	// chunks dealt to one thread; it takes from the front, and threads
+	// that run dry steal from the back
+	struct WorkQueue
+	{
+		std::mutex lock;
+		std::deque<int> chunks;
+	};
+
+	void WorkerLoop(int index);
+	void RunChunks(int index);
+	bool NextChunk(int index, int* chunkIndex);
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<WorkQueue> > queues;	// workers, then caller
+	std::mutex callMutex;			// one ParallelFor at a time
+	std::mutex jobMutex;
+	std::condition_variable jobReady;
+	std::condition_variable jobDone;
+	const std::function<void(int, int)>* body;
+	int count;
+	int chunk;
+	int active;					// workers still inside the current job
+	unsigned generation;
+	bool stopping;
+};
+
+// shared pool used by the filter engine
+ThreadPool& DefaultThreadPool();
@@ -16,29 +16,35 @@ out vec4 FragmentColour;
 
 uniform sampler2D ourTexture;
 uniform sampler2D borderTexture;
-uniform int mode;
-uniform int filt;
 uniform int w;
 uniform int h;
-uniform int gSize;
 uniform int hori;
 uniform int level;
 
+// specialized builds get the filter as #defines after the #version line,
+// so untaken branches fold away and the kernel loops have compile-time
+// bounds; the generic build reads the same values from uniforms
+#ifdef MODE
+const int mode = MODE;
+const int filt = FILT;
+const int gSize = GSIZE;
+const int linearTaps = LINEAR_TAPS;
+#else
+uniform int mode;
+uniform int filt;
+uniform int gSize;
+uniform int linearTaps;
+#endif
+
+
+// normalized gaussian1D taps 0..bound, computed on the host whenever the
+// kernel changes; the 2D kernel of mode 2 is the product of two of these
+uniform float weights[129];
+// the same kernel with tap pairs merged into bilinear fetches; mode 3 uses
+// these instead when linearTaps is non-zero
+uniform float linearOffsets[65];
+uniform float linearWeights[65];
 
-const float e = 2.71828182845904523536028747135266249775724709369995957;
-const float pi = 3.141592653589793238462643383279502884197169;
-float gaussian2D(float sigma, float x, float y) {
-//	float sigma = 1.0f;
-	float exponent = (x*x+y*y)/(2*sigma*sigma);
-	return 1/(pow(e,exponent)*(2*pi*sigma*sigma));
-	//return 0;
-}
-float gaussian1D(float sigma, float x) {
-//	float sigma = 1.0f;
-	float exponent = (x*x)/(2*sigma*sigma);
-	return 1/(pow(e,exponent)*sqrt(2*pi*sigma*sigma));
-	//return 0;
-}
 void main(void)
 {
 	
@@ -99,15 +105,10 @@ void main(void)
 		
 		if (filt != 0) {
 			int bound = (gSize-1)/2;
-			float sigma = .15f+0.45*filt;//0.665f+.25f*filt;//+0.2f*filt;//+filt/bound;
-			float total = 0;
 			vec4 blur = vec4(0);//texture(ourTexture, -UV);//vec4(vec3(.2f,.2f,.2f),0.0f);// = 0*texture(ourTexture, UV);
 			for (int i=-bound; i<=bound; i++) {
 				for (int j=-bound; j<=bound; j++) {
-					//blur = blur + ((1.0f/(2.0f*pi*pow(sigma,2)))*pow(e,-((pow(i*1.0f,2)+pow(j*1.0f,2))/(2.0f*pow(sigma,2)))))*texture(ourTexture, UV-vec2(i*1.0f/w,j*1.0f/h));
-					//FragmentColour = FragmentColour + texture(ourTexture,UV-(
-					blur = blur + gaussian2D(sigma,i*1.0f,j*1.0f)*texture(ourTexture, UV-vec2((i*1.0f)/w,(j*1.0f)/h));
-//					total = gaussian(sigma,i,j);
+					blur = blur + weights[abs(i)]*weights[abs(j)]*texture(ourTexture, UV-vec2((i*1.0f)/w,(j*1.0f)/h));
 				}
 			}
 			FragmentColour = blur;
@@ -119,17 +120,17 @@ void main(void)
 	else if (mode == 3) {
 		if (filt!=0) {
 			int bound = (gSize-1)/2;
-			float sigma = .15f+0.45*filt;//0.665f+.25f*filt;//+0.2f*filt;//+filt/bound;
-			float total = 0;
 			vec4 blur = vec4(0);//texture(ourTexture, -UV);//vec4(vec3(.2f,.2f,.2f),0.0f);// = 0*texture(ourTexture, UV);
-			for (int i=-bound; i<=bound; i++) {
-				//blur = blur + ((1.0f/(2.0f*pi*pow(sigma,2)))*pow(e,-((pow(i*1.0f,2)+pow(j*1.0f,2))/(2.0f*pow(sigma,2)))))*texture(ourTexture, UV-vec2(i*1.0f/w,j*1.0f/h));
-				//FragmentColour = FragmentColour + texture(ourTexture,UV-(
-				if (hori == 1)
-					blur = blur + gaussian1D(sigma,i*1.0f)*texture(ourTexture, UV-vec2((i*1.0f)/w,0.0f/h));
-				else
-					blur = blur + gaussian1D(sigma,i*1.0f)*texture(ourTexture, UV-vec2(0.0f/w,(i*1.0f)/h));
-		//					total = gaussian(sigma,i,j);
+			vec2 step = (hori == 1) ? vec2(1.0f/w, 0.0f) : vec2(0.0f, 1.0f/h);
+			if (linearTaps > 0) {
+				blur = linearWeights[0]*texture(ourTexture, UV);
+				for (int i=1; i<linearTaps; i++)
+					blur = blur + linearWeights[i]*(texture(ourTexture, UV-linearOffsets[i]*step) +
+						texture(ourTexture, UV+linearOffsets[i]*step));
+			}
+			else {
+				for (int i=-bound; i<=bound; i++)
+					blur = blur + weights[abs(i)]*texture(ourTexture, UV-i*step);
 			}
 		//			if (total < 1.0f)
 		//				FragmentColour = vec4(Colour,0.0);
@@ -164,6 +165,29 @@ void main(void)
 		}*/
 			
 	}
+	else if (mode == 5) {
+		// dual Kawase pyramid: hori == 1 downsamples into a half-size target,
+		// hori == 0 upsamples into a double-size one; w and h are the
+		// size of the texture being read
+		vec2 halfpixel = vec2(0.5f/w, 0.5f/h);
+		if (hori == 1) {
+			FragmentColour = (4.0f*texture(ourTexture, UV) +
+				texture(ourTexture, UV-halfpixel) +
+				texture(ourTexture, UV+halfpixel) +
+				texture(ourTexture, UV+vec2(halfpixel.x, -halfpixel.y)) +
+				texture(ourTexture, UV-vec2(halfpixel.x, -halfpixel.y)))/8.0f;
+		}
+		else {
+			FragmentColour = (texture(ourTexture, UV+vec2(-2.0f*halfpixel.x, 0.0f)) +
+				texture(ourTexture, UV+vec2(2.0f*halfpixel.x, 0.0f)) +
+				texture(ourTexture, UV+vec2(0.0f, -2.0f*halfpixel.y)) +
+				texture(ourTexture, UV+vec2(0.0f, 2.0f*halfpixel.y)) +
+				2.0f*texture(ourTexture, UV+halfpixel) +
+				2.0f*texture(ourTexture, UV-halfpixel) +
+				2.0f*texture(ourTexture, UV+vec2(halfpixel.x, -halfpixel.y)) +
+				2.0f*texture(ourTexture, UV-vec2(halfpixel.x, -halfpixel.y)))/12.0f;
+		}
+	}
 	else{
 		FragmentColour = texture(ourTexture, UV);
 	}
@@ -17,10 +17,13 @@ layout(location = 2) in vec2 TexturePos;
 out vec3 Colour;
 out vec2 UV;
 
+// places the unit quad: the view's pan, zoom and rotation for the image on
+// screen, identity for offscreen passes
+uniform mat3 transform;
+
 void main()
 {
-    // assign vertex position without modification
-    gl_Position = vec4(VertexPosition, 0.0, 1.0);
+    gl_Position = vec4((transform*vec3(VertexPosition, 1.0)).xy, 0.0, 1.0);
 
     // assign output colour to be interpolated
     Colour = VertexColour;